@@ -17,19 +17,16 @@ int main(int argc, const char** argv) {
 		auto f = pfd::open_file(
 			"Choose scene",
 			"",
-			{ "PLY files (.ply)", "*.ply" },
+			{ "Scene files (.ply .rmsh)", "*.ply *.rmsh" },
 			false
 		);
 		for (const std::string& filepath : f.result()) {
-			renderer.LoadScene(*app.contexts[app.swapchain->ImageIndex()], filepath);
+			renderer.LoadSceneAsync(*app.contexts[app.swapchain->ImageIndex()], filepath);
 		}
 	};
 
-	if (argc > 1) {
-		app.contexts[0]->Begin();
-		renderer.LoadScene(*app.contexts[0], argv[1]);
-		app.contexts[0]->Submit();
-	}
+	if (argc > 1)
+		renderer.LoadSceneAsync(*app.contexts[0], argv[1]);
 
 	app.AddMenuItem("File", [&]() {
 		if (ImGui::MenuItem("Open scene")) {
@@ -0,0 +1,54 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "cxxopts.h"
+
+#include "Scene/PackedScene.hpp"
+
+using namespace vkDelTet;
+
+// Offline baking of .ply checkpoints into .rmsh packed scenes, for render nodes and CI.
+// Runs entirely on the CPU: no window, no Vulkan device.
+int main(int argc, const char** argv) {
+    cxxopts::Options options("rmvk-bake", "Bakes a tetrahedral scene checkpoint into a packed scene.");
+    options.add_options()
+        ("i,input", "Path to the .ply checkpoint", cxxopts::value<std::string>())
+        ("o,output", "Path to the packed scene (defaults to the input with a .rmsh extension)", cxxopts::value<std::string>())
+        ("sh", "SH encoding (fp32, fp16, 8-bit, codebook)", cxxopts::value<std::string>()->default_value("fp16"))
+        ("keep_degenerate", "Keep tets no renderer would draw", cxxopts::value<bool>()->default_value("false"))
+        ("no_reorder", "Keep the file order instead of sorting along a Morton curve", cxxopts::value<bool>()->default_value("false"))
+        ("h,help", "Print usage");
+    options.parse_positional({ "input" });
+    options.positional_help("<input.ply>");
+
+    auto result = options.parse(argc, argv);
+    if (result.count("help") || !result.count("input")) {
+        std::cout << options.help() << std::endl;
+        return result.count("help") ? 0 : 1;
+    }
+
+    const std::filesystem::path input = result["input"].as<std::string>();
+    const std::filesystem::path output = result.count("output") ?
+        std::filesystem::path(result["output"].as<std::string>()) :
+        std::filesystem::path(input).replace_extension(".rmsh");
+
+    BakeOptions bake;
+    bake.dropDegenerate = !result["keep_degenerate"].as<bool>();
+    bake.spatialReorder = !result["no_reorder"].as<bool>();
+    const std::string shFormat = result["sh"].as<std::string>();
+    bool found = false;
+    for (const SHFormat f : { SHFormat::eFloat32, SHFormat::eFloat16, SHFormat::eUNorm8, SHFormat::eCodebook }) {
+        if (shFormat == SHFormatName(f)) {
+            bake.shFormat = f;
+            found = true;
+        }
+    }
+    if (!found) {
+        std::cerr << "Unknown SH format " << shFormat << std::endl;
+        return 1;
+    }
+
+    std::cout << "Baking " << input << " on " << WorkerCount() << " threads" << std::endl;
+    return BakePackedScene(input, output, bake) ? 0 : 1;
+}
@@ -5,6 +5,8 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <cmath>
+#include <limits>
 #include <vulkan/vulkan_enums.hpp>
 
 // Add the cxxopts header
@@ -12,6 +14,7 @@
 
 #include "DelaunayTetRenderer.hpp"
 #include "ColmapUtils.h"
+#include "Scene/HalfConvert.hpp"
 
 using namespace vkDelTet;
 
@@ -35,6 +38,269 @@ Eigen::Matrix4f loadMatrixFromFile(const std::string& filename) {
     return Eigen::Map<Eigen::Matrix<float, 4, 4, Eigen::RowMajor>>(data.data());
 }
 
+// Renders each camera offscreen and reads the RGBA8 result back to the host.
+// warmupFrames are rendered first, for state carried over from the previous frame.
+std::vector<std::vector<uint8_t>> RenderCameras(WindowedApp& app, DelaunayTetRenderer& renderer, const std::vector<ColmapCamera>& cameras, const int downsampleFactor, const uint32_t warmupFrames = 0) {
+    CommandContext& context = *app.contexts[0];
+    std::vector<std::vector<uint8_t>> images;
+    for (const ColmapCamera& cam : cameras) {
+        renderer.renderContext.camera = cam.camera;
+        const uint2 extent = cam.dimensions / (uint)downsampleFactor;
+
+        BufferRange<uint8_t> readback = Buffer::Create(
+            context.GetDevice(),
+            extent.x * extent.y * 4,
+            vk::BufferUsageFlagBits::eTransferDst,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+
+        context.Begin();
+        for (uint32_t i = 0; i < warmupFrames; i++)
+            renderer.RenderOffscreen(context, extent);
+        renderer.RenderOffscreen(context, extent);
+        context.AddBarrier(renderer.renderContext.renderTarget, Image::ResourceState{
+            .layout = vk::ImageLayout::eTransferSrcOptimal,
+            .stage  = vk::PipelineStageFlagBits2::eTransfer,
+            .access = vk::AccessFlagBits2::eTransferRead,
+            .queueFamily = context.QueueFamily() });
+        context.ExecuteBarriers();
+        context->copyImageToBuffer(
+            **renderer.renderContext.renderTarget.GetImage(),
+            vk::ImageLayout::eTransferSrcOptimal,
+            **readback.mBuffer,
+            vk::BufferImageCopy{
+                .bufferOffset = readback.mOffset,
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = { vk::ImageAspectFlagBits::eColor, 0, 0, 1 },
+                .imageOffset = { 0, 0, 0 },
+                .imageExtent = { extent.x, extent.y, 1 } });
+        context.Submit();
+        app.device->Wait();
+
+        images.emplace_back(readback.data(), readback.data() + readback.size());
+    }
+    return images;
+}
+
+// Average wall time of one offscreen frame over every camera, in milliseconds.
+// Each camera is rendered several times per submission so the GPU stays the bottleneck.
+double TimeFrames(WindowedApp& app, DelaunayTetRenderer& renderer, const std::vector<ColmapCamera>& cameras, const int downsampleFactor, const uint32_t repeats = 16) {
+    CommandContext& context = *app.contexts[0];
+    double totalMs = 0;
+    for (const ColmapCamera& cam : cameras) {
+        renderer.renderContext.camera = cam.camera;
+        const uint2 extent = cam.dimensions / (uint)downsampleFactor;
+        // warm up pipelines and the render target
+        context.Begin();
+        renderer.RenderOffscreen(context, extent);
+        context.Submit();
+        app.device->Wait();
+
+        const auto t0 = std::chrono::steady_clock::now();
+        context.Begin();
+        for (uint32_t i = 0; i < repeats; i++)
+            renderer.RenderOffscreen(context, extent);
+        context.Submit();
+        app.device->Wait();
+        totalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / repeats;
+    }
+    return totalMs / cameras.size();
+}
+
+// PSNR over the RGB channels of two RGBA8 images.
+double ComputePSNR(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+    double sse = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (i % 4 == 3) continue;
+        const double d = (double)a[i] - (double)b[i];
+        sse += d * d;
+        n++;
+    }
+    if (sse == 0) return std::numeric_limits<double>::infinity();
+    return 10.0 * std::log10(255.0 * 255.0 / (sse / n));
+}
+
+// Largest difference of an RGB channel between two RGBA8 images.
+uint32_t MaxChannelDifference(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+    uint32_t m = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        if (i % 4 != 3)
+            m = std::max<uint32_t>(m, std::max(a[i], b[i]) - std::min(a[i], b[i]));
+    return m;
+}
+
+// Must match hash in ScanBench.cs.slang
+uint32_t ScanBenchHash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Times the single-pass compaction scan of Scan.slang from 1M to 100M elements, keeping about half
+// of them, and checks the kept count and the start of the output against the CPU.
+void BenchmarkScan(WindowedApp& app, const uint32_t repeats = 16) {
+    CommandContext& context = *app.contexts[0];
+    Device& device = context.GetDevice();
+    PipelineCache fillPipeline    = PipelineCache(FindShaderPath("ScanBench.cs.slang"), "fill");
+    PipelineCache compactPipeline = PipelineCache(FindShaderPath("ScanBench.cs.slang"), "compact");
+    const uint32_t threshold = 0x80000000u;
+
+    for (const uint32_t count : { 1u << 20, 4u << 20, 16u << 20, 64u << 20, 100'000'000u }) {
+        const uint32_t numTiles = ScanTileCount(count);
+        const uint32_t checked  = std::min<uint32_t>(count, 1u << 20);
+        BufferRange<uint> values    = Buffer::Create(device, count*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer);
+        BufferRange<uint> compacted = Buffer::Create(device, count*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc);
+        BufferRange<uint> scanState = Buffer::Create(device, (2 + numTiles)*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst);
+        BufferRange<uint> readback  = Buffer::Create(device, (1 + checked)*sizeof(uint),
+            vk::BufferUsageFlagBits::eTransferDst,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+
+        ShaderParameter params = {};
+        params["count"]     = count;
+        params["numTiles"]  = numTiles;
+        params["threshold"] = threshold;
+        params["values"]    = (BufferParameter)values;
+        params["compacted"] = (BufferParameter)compacted;
+        params["scanState"] = (BufferParameter)scanState;
+
+        auto scan = [&]() {
+            context.Fill(scanState.cast<uint32_t>(), 0u);
+            context.AddBarrier(scanState, {
+                .stage  = vk::PipelineStageFlagBits2::eComputeShader,
+                .access = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite
+            });
+            context.AddBarrier(compacted, {
+                .stage  = vk::PipelineStageFlagBits2::eComputeShader,
+                .access = vk::AccessFlagBits2::eShaderWrite
+            });
+            context.ExecuteBarriers();
+            compactPipeline(context, uint3(numTiles * SCAN_GROUP_SIZE, 1u, 1u), params);
+            context.AddBarrier(scanState, {
+                .stage  = vk::PipelineStageFlagBits2::eTransfer,
+                .access = vk::AccessFlagBits2::eTransferRead | vk::AccessFlagBits2::eTransferWrite
+            });
+        };
+
+        // fill, then one scan that is checked
+        context.Begin();
+        fillPipeline(context, uint3(count, 1u, 1u), params);
+        context.AddBarrier(values, {
+            .stage  = vk::PipelineStageFlagBits2::eComputeShader,
+            .access = vk::AccessFlagBits2::eShaderRead
+        });
+        scan();
+        context.AddBarrier(compacted, {
+            .stage  = vk::PipelineStageFlagBits2::eTransfer,
+            .access = vk::AccessFlagBits2::eTransferRead
+        });
+        context.ExecuteBarriers();
+        context->copyBuffer(**scanState.mBuffer, **readback.mBuffer,
+            vk::BufferCopy{ scanState.mOffset + sizeof(uint), readback.mOffset, sizeof(uint) });
+        context->copyBuffer(**compacted.mBuffer, **readback.mBuffer,
+            vk::BufferCopy{ compacted.mOffset, readback.mOffset + sizeof(uint), checked*sizeof(uint) });
+        context.Submit();
+        app.device->Wait();
+
+        uint32_t expected = 0;
+        bool valid = true;
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t v = ScanBenchHash(i);
+            if (v >= threshold)
+                continue;
+            if (expected < checked && readback.data()[1 + expected] != v)
+                valid = false;
+            expected++;
+        }
+        valid = valid && readback.data()[0] == expected;
+
+        const auto t0 = std::chrono::steady_clock::now();
+        context.Begin();
+        for (uint32_t i = 0; i < repeats; i++)
+            scan();
+        context.Submit();
+        app.device->Wait();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / repeats;
+
+        // each element is read once and about half are written
+        const double bytes = (double)count * sizeof(uint) + (double)expected * sizeof(uint);
+        std::cout << "Scan " << count << " elements: " << ms << " ms, " << count / (ms * 1e6) << " Gelem/s, "
+                  << bytes / (ms * 1e6) << " GB/s, " << (valid ? "valid" : "INVALID") << std::endl;
+    }
+}
+
+// Checks FloatToHalf against f32tof16 in Compression.cs.slang for every fp32 bit pattern, which covers
+// denormals, rounding ties, overflow and NaNs. Prints the first mismatches of each class.
+bool TestHalfConversion(WindowedApp& app) {
+    CommandContext& context = *app.contexts[0];
+    Device& device = context.GetDevice();
+    PipelineCache compressPipeline = PipelineCache(FindShaderPath("Compression.cs.slang"));
+    Pipeline& f32tof16Pipeline = *compressPipeline.get(device, {
+        { "INPUT_TYPE",  "float" },
+        { "OUTPUT_TYPE", "uint" },
+        { "COMPRESS_FN", "f32tof16(i)" },
+    });
+
+    const uint32_t chunk = 1u << 20; // 32K groups, within the dispatch limit
+    const vk::MemoryPropertyFlags hostFlags = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    BufferRange<uint32_t> input  = Buffer::Create(device, chunk*sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer, hostFlags,
+        VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+    BufferRange<uint32_t> output = Buffer::Create(device, chunk*sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer, hostFlags,
+        VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+
+    ShaderParameter params = {};
+    params["inputData"]  = (BufferParameter)input;
+    params["outputData"] = (BufferParameter)output;
+    params["count"]      = chunk;
+
+    auto classify = [](const uint32_t bits) {
+        const uint32_t absx = bits & 0x7fffffff;
+        if (absx > 0x7f800000)  return "NaN";
+        if (absx >= 0x477ff000) return "overflow or infinite";
+        if (absx <  0x38800000) return "denormal";
+        return (absx & 0x1fff) == 0x1000 ? "tie" : "normal";
+    };
+    std::map<std::string, uint64_t> mismatches;
+    std::vector<float>    values(chunk);
+    std::vector<uint16_t> expected(chunk);
+    for (uint64_t first = 0; first < (uint64_t(1) << 32); first += chunk) {
+        for (uint32_t i = 0; i < chunk; i++) {
+            const uint32_t bits = (uint32_t)(first + i);
+            std::memcpy(&values[i], &bits, sizeof(float));
+        }
+        std::memcpy(input.data(), values.data(), chunk*sizeof(float));
+        context.Begin();
+        context.Dispatch(f32tof16Pipeline, chunk, params);
+        context.Submit();
+        FloatToHalf(values.data(), expected.data(), chunk);
+        app.device->Wait();
+        for (uint32_t i = 0; i < chunk; i++) {
+            // the batch converter may take the F16C path, so the scalar one is checked as well
+            const uint16_t scalar = FloatToHalf(values[i]);
+            if (output.data()[i] == expected[i] && output.data()[i] == scalar)
+                continue;
+            const uint32_t bits = (uint32_t)(first + i);
+            if (mismatches[classify(bits)]++ < 4)
+                std::cerr << "f32tof16(0x" << std::hex << bits << ") = 0x" << output.data()[i] << ", FloatToHalf gives 0x"
+                          << expected[i] << ", scalar 0x" << scalar << std::dec << " (" << classify(bits) << ")" << std::endl;
+        }
+    }
+    for (const auto& [name, count] : mismatches)
+        std::cout << count << " " << name << " inputs differ" << std::endl;
+#ifdef VKDELTET_X86
+    const char* path = CpuHasF16C() ? "F16C" : "scalar";
+#else
+    const char* path = "scalar";
+#endif
+    std::cout << "FloatToHalf (" << path << ") " << (mismatches.empty() ? "matches" : "DOES NOT match") << " f32tof16 for all 2^32 inputs" << std::endl;
+    return mismatches.empty();
+}
+
 int main(int argc, const char** argv) {
     // --- Argument Parsing ---
     cxxopts::Options options("TetRenderer", "A Delaunay tetrahedral mesh renderer benchmark tool.");
@@ -49,15 +315,44 @@ int main(int argc, const char** argv) {
         ("d,downsample", "Downsample factor for 'test' resolution", cxxopts::value<int>()->default_value("4"))
         // ++ NEW OPTION: Add a resolution parameter ++
         ("r,resolution", "Set render resolution (test, 1080p, 2k, 4k)", cxxopts::value<std::string>()->default_value("test"))
+        ("vertex_bench", "Compare fp32 and quantized vertex positions in the mesh shader and raster renderers, then exit", cxxopts::value<bool>()->default_value("false"))
+        ("layout_bench", "Compare separate and interleaved per-tet layouts in the mesh shader and raster renderers, then exit", cxxopts::value<bool>()->default_value("false"))
+        ("scan_bench", "Time the compaction scan from 1M to 100M elements, then exit (no scene needed)", cxxopts::value<bool>()->default_value("false"))
+        ("half_test", "Check the CPU fp16 conversion bit-exactly against f32tof16 on the GPU, then exit (no scene needed)", cxxopts::value<bool>()->default_value("false"))
+        ("occlusion_bench", "Compare occlusion culling modes in the mesh shader renderer: time, overdraw and PSNR, then exit", cxxopts::value<bool>()->default_value("false"))
+        ("opacity_bench", "Compare opacity culling thresholds in the mesh shader renderer: time, culled tets and PSNR, then exit", cxxopts::value<bool>()->default_value("false"))
+        ("sh_psnr", "Report the PSNR of 8-bit and codebook SH against fp16 SH on the benchmark cameras, then exit", cxxopts::value<bool>()->default_value("false"))
         ("h,help", "Print usage");
 
     auto result = options.parse(argc, argv);
 
-    if (result.count("help") || !result.count("scene") || !result.count("colmap")) {
+    const bool scanBench = result["scan_bench"].as<bool>();
+    const bool halfTest  = result["half_test"].as<bool>();
+    if (result.count("help") || (!scanBench && !halfTest && (!result.count("scene") || !result.count("colmap")))) {
         std::cout << options.help() << std::endl;
         return EXIT_SUCCESS;
     }
 
+    if (scanBench) {
+        WindowedApp app("TetRenderer", {
+            VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+            VK_EXT_MESH_SHADER_EXTENSION_NAME
+        });
+        BenchmarkScan(app);
+        app.device->Wait();
+        return EXIT_SUCCESS;
+    }
+
+    if (halfTest) {
+        WindowedApp app("TetRenderer", {
+            VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+            VK_EXT_MESH_SHADER_EXTENSION_NAME
+        });
+        const bool passed = TestHalfConversion(app);
+        app.device->Wait();
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     const std::string scenePath = result["scene"].as<std::string>();
     const std::string colmapSparsePath = result["colmap"].as<std::string>();
     const bool fovXfovYFlag = result["fov"].as<bool>();
@@ -124,9 +419,9 @@ int main(int argc, const char** argv) {
 
     // ... (No changes to openSceneDialog, app setup, etc.) ...
     auto openSceneDialog = [&]() {
-        auto f = pfd::open_file("Choose scene", "", { "PLY files (.ply)", "*.ply" }, false);
+        auto f = pfd::open_file("Choose scene", "", { "Scene files (.ply .rmsh)", "*.ply *.rmsh" }, false);
         for (const std::string& filepath : f.result()) {
-            renderer.LoadScene(*app.contexts[app.swapchain->ImageIndex()], filepath);
+            renderer.LoadSceneAsync(*app.contexts[app.swapchain->ImageIndex()], filepath);
         }
     };
 
@@ -136,6 +431,190 @@ int main(int argc, const char** argv) {
     renderer.renderContext.scene.sceneRotation = float3(0, 0, 0);
     app.contexts[0]->Submit();
 
+    if (result["sh_psnr"].as<bool>()) {
+        auto loadWithFormat = [&](const SHFormat format) {
+            renderer.renderContext.scene.SetSHFormat(format);
+            app.contexts[0]->Begin();
+            renderer.LoadScene(*app.contexts[0], scenePath);
+            app.contexts[0]->Submit();
+            app.device->Wait();
+        };
+
+        loadWithFormat(SHFormat::eFloat16);
+        const auto reference = RenderCameras(app, renderer, benchmarkCameras, downsampleFactor);
+        for (const SHFormat format : { SHFormat::eUNorm8, SHFormat::eCodebook }) {
+            loadWithFormat(format);
+            const auto quantized = RenderCameras(app, renderer, benchmarkCameras, downsampleFactor);
+
+            double sum = 0;
+            for (size_t i = 0; i < benchmarkCameras.size(); i++) {
+                const double psnr = ComputePSNR(reference[i], quantized[i]);
+                std::cout << "Camera " << i << ": " << SHFormatName(format) << " vs fp16 PSNR " << psnr << " dB" << std::endl;
+                sum += psnr;
+            }
+            // Print in a machine-readable format for easy parsing
+            std::cout << "Mean SH " << SHFormatName(format) << " PSNR: " << sum / benchmarkCameras.size() << std::endl;
+        }
+        app.device->Wait();
+        return EXIT_SUCCESS;
+    }
+
+    if (result["vertex_bench"].as<bool>()) {
+        TetrahedronScene& scene = renderer.renderContext.scene;
+        std::vector<uint32_t> renderers;
+        for (uint32_t i = 0; i < renderer.RendererCount(); i++)
+            if (std::string_view(renderer.RendererName(i)) == "Mesh shader" || std::string_view(renderer.RendererName(i)) == "HW Raster")
+                renderers.push_back(i);
+
+        for (const VertexFormat format : { VertexFormat::eFloat32, VertexFormat::eUNorm21 }) {
+            scene.SetVertexFormat(format);
+            app.contexts[0]->Begin();
+            renderer.LoadScene(*app.contexts[0], scenePath);
+            app.contexts[0]->Submit();
+            app.device->Wait();
+
+            // every tet reads its 4 vertices in markTets, and each of the 12 raster vertices of a drawn tet reads all 4 again
+            const size_t vertexSize = format == VertexFormat::eUNorm21 ? sizeof(uint2) : sizeof(float3);
+            const float3 error = scene.MaxVertexError();
+            std::cout << "Vertex format " << VertexFormatName(format) << ": " << (scene.VertexCount() * vertexSize >> 20) << " MiB, max error "
+                      << error.x << " " << error.y << " " << error.z << std::endl;
+            std::cout << "  markTets vertex reads: " << ((size_t)scene.TetCount() * 4 * vertexSize >> 20) << " MiB/frame" << std::endl;
+            std::cout << "  raster vertex reads (all tets drawn): " << ((size_t)scene.TetCount() * 12 * 4 * vertexSize >> 20) << " MiB/frame" << std::endl;
+            for (const uint32_t r : renderers) {
+                renderer.SetRenderer(r);
+                std::cout << "  " << renderer.RendererName(r) << ": " << TimeFrames(app, renderer, benchmarkCameras, downsampleFactor) << " ms/frame" << std::endl;
+            }
+        }
+        renderer.SetRenderer(0);
+        app.device->Wait();
+        return EXIT_SUCCESS;
+    }
+
+    if (result["layout_bench"].as<bool>()) {
+        TetrahedronScene& scene = renderer.renderContext.scene;
+        std::vector<uint32_t> renderers;
+        for (uint32_t i = 0; i < renderer.RendererCount(); i++)
+            if (std::string_view(renderer.RendererName(i)) == "Mesh shader" || std::string_view(renderer.RendererName(i)) == "HW Raster")
+                renderers.push_back(i);
+
+        // the separate layout reads indices, density, gradient, offset and the DC term from five buffers
+        const PrecisionPolicy& precision = scene.GetPrecision();
+        const size_t separateBytes = sizeof(uint4) + precision.DensitySize() + precision.GradientSize() + sizeof(float) +
+            (precision.sh == SHFormat::eFloat32 ? sizeof(float3) : 3 * sizeof(uint16_t));
+
+        std::map<uint32_t, std::vector<std::vector<uint8_t>>> reference;
+        for (const TetLayout layout : { TetLayout::eSeparate, TetLayout::eRecord32, TetLayout::eRecord48 }) {
+            app.contexts[0]->Begin();
+            scene.SetTetLayout(*app.contexts[0], layout);
+            app.contexts[0]->Submit();
+            app.device->Wait();
+
+            const size_t recordBytes = layout == TetLayout::eSeparate ? separateBytes : TetRecordSize(layout);
+            std::cout << "Tet layout " << TetLayoutName(layout) << ": " << recordBytes << " bytes/tet fetched from "
+                      << (layout == TetLayout::eSeparate ? 5 : 1) << " buffers, "
+                      << ((size_t)scene.TetCount() * TetRecordSize(layout) >> 20) << " MiB of records" << std::endl;
+            for (const uint32_t r : renderers) {
+                renderer.SetRenderer(r);
+                std::cout << "  " << renderer.RendererName(r) << ": " << TimeFrames(app, renderer, benchmarkCameras, downsampleFactor) << " ms/frame";
+                // 32 byte records round density, gradient, offset and DC to fp16
+                const auto images = RenderCameras(app, renderer, benchmarkCameras, downsampleFactor);
+                if (layout == TetLayout::eSeparate)
+                    reference[r] = images;
+                else {
+                    double sum = 0;
+                    for (size_t i = 0; i < images.size(); i++)
+                        sum += ComputePSNR(reference[r][i], images[i]);
+                    std::cout << ", PSNR vs separate " << sum / images.size() << " dB";
+                }
+                std::cout << std::endl;
+            }
+        }
+        renderer.SetRenderer(0);
+        app.device->Wait();
+        return EXIT_SUCCESS;
+    }
+
+    if (result["occlusion_bench"].as<bool>()) {
+        RenderContext& rc = renderer.renderContext;
+        for (uint32_t i = 0; i < renderer.RendererCount(); i++)
+            if (std::string_view(renderer.RendererName(i)) == "Mesh shader")
+                renderer.SetRenderer(i);
+
+        // Tets culled by the conservative mode lie behind a transmittance below occlusionEpsilon, so
+        // together they can't change a channel by more than that. Anything beyond is a culling error.
+        const uint32_t tolerance = (uint32_t)std::ceil(rc.occlusionEpsilon * 255);
+        bool lossless = true;
+        std::vector<std::vector<uint8_t>> reference;
+        for (const int mode : { 0, 1, 2 }) {
+            rc.occlusionCulling      = mode != 0;
+            rc.occlusionConservative = mode == 1;
+            const char* name = mode == 0 ? "off" : mode == 1 ? "conservative" : "aggressive";
+            // every frame is rendered after one of the same camera, so the pyramid is from the same view
+            const double ms = TimeFrames(app, renderer, benchmarkCameras, downsampleFactor);
+            double overdrawBefore = 0, overdrawAfter = 0, psnr = 0;
+            uint64_t occluded = 0;
+            uint32_t maxDifference = 0;
+            for (size_t i = 0; i < benchmarkCameras.size(); i++) {
+                const auto image = RenderCameras(app, renderer, { benchmarkCameras[i] }, downsampleFactor, 1)[0];
+                const float2 overdraw = rc.Overdraw();
+                overdrawBefore += overdraw.x;
+                overdrawAfter  += overdraw.y;
+                occluded       += rc.OccludedCount();
+                if (mode == 0)
+                    reference.push_back(image);
+                else {
+                    psnr += ComputePSNR(reference[i], image);
+                    maxDifference = std::max(maxDifference, MaxChannelDifference(reference[i], image));
+                }
+            }
+            const double n = (double)benchmarkCameras.size();
+            std::cout << "Occlusion culling " << name << ": " << ms << " ms/frame, overdraw " << overdrawBefore / n << "x -> "
+                      << overdrawAfter / n << "x, " << occluded / benchmarkCameras.size() << " occluded tets";
+            if (mode != 0)
+                std::cout << ", PSNR vs off " << psnr / n << " dB, max difference " << maxDifference << "/255";
+            std::cout << std::endl;
+            if (mode == 1 && maxDifference > tolerance) {
+                std::cerr << "Conservative occlusion culling is not lossless: a channel differs by " << maxDifference
+                          << "/255, more than the " << tolerance << "/255 its epsilon allows." << std::endl;
+                lossless = false;
+            }
+        }
+        rc.occlusionCulling = false;
+        renderer.SetRenderer(0);
+        app.device->Wait();
+        return lossless ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (result["opacity_bench"].as<bool>()) {
+        RenderContext& rc = renderer.renderContext;
+        for (uint32_t i = 0; i < renderer.RendererCount(); i++)
+            if (std::string_view(renderer.RendererName(i)) == "Mesh shader")
+                renderer.SetRenderer(i);
+
+        std::vector<std::vector<uint8_t>> reference;
+        for (const float epsilon : { 0.f, 1.f / 1024.f, 1.f / 255.f, 1.f / 64.f }) {
+            rc.opacityEpsilon = epsilon;
+            const double ms = TimeFrames(app, renderer, benchmarkCameras, downsampleFactor);
+            const auto images = RenderCameras(app, renderer, benchmarkCameras, downsampleFactor);
+            // the counts are from the last camera
+            std::cout << "Min opacity " << epsilon << ": " << ms << " ms/frame, " << rc.TransparentCount() << " of "
+                      << rc.scene.TetCount() << " tets culled";
+            if (epsilon == 0)
+                reference = images;
+            else {
+                double sum = 0;
+                for (size_t i = 0; i < images.size(); i++)
+                    sum += ComputePSNR(reference[i], images[i]);
+                std::cout << ", PSNR vs 0 " << sum / images.size() << " dB";
+            }
+            std::cout << std::endl;
+        }
+        rc.opacityEpsilon = 0;
+        renderer.SetRenderer(0);
+        app.device->Wait();
+        return EXIT_SUCCESS;
+    }
+
     bool isBenchmarking = false;
     int currentCameraIndex = 0;
     int frameCount = 0;
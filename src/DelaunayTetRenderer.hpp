@@ -1,6 +1,11 @@
 #pragma once
 
+#include <chrono>
+#include <cmath>
+#include <future>
 #include <iterator>
+#include <limits>
+#include <memory>
 #include <stack>
 
 #include <Rose/Core/CommandContext.hpp>
@@ -30,6 +35,124 @@ private:
 
 	uint32_t rendererIndex = 0;
 
+	// Asynchronous load in progress. The worker only reads, converts and queues uploads;
+	// copies are submitted and the scenes are swapped from the render thread.
+	std::unique_ptr<TetrahedronScene> m_loadingScene;
+	std::future<bool>                 m_loadingPrepared; // declared after m_loadingScene, so the worker is joined first
+	std::filesystem::path             m_loadingPath;
+
+	// One-shot measurement of the image error of opacity culling: the next frame is also rendered
+	// without it into m_errorReference, and ImageError.cs.slang compares the two.
+	PipelineCache     m_imageErrorPipeline = PipelineCache(FindShaderPath("ImageError.cs.slang"));
+	bool              m_measureOpacityError = false;
+	BufferRange<uint> m_errorReference;
+	BufferRange<uint> m_errorResult;
+	BufferRange<uint> m_errorReadback; // host visible copy of m_errorResult
+	uint2             m_errorExtent = uint2(0); // of the last measurement
+
+	inline void OnSceneChanged(CommandContext& context) {
+		if (renderContext.scene.VertexCount() > 0) {
+			renderContext.PrepareScene(context, renderContext.scene.GetShaderParameter());
+			m_highlightRenderer.PrepareBuffers(context, renderContext.scene);
+		}
+	}
+
+	// Swaps in the scene being loaded once its uploads have completed. Only waits for the
+	// device at the swap itself, since earlier frames may still read the old scene's buffers.
+	inline void UpdateLoading(CommandContext& context) {
+		if (!m_loadingScene)
+			return;
+		if (m_loadingPrepared.valid()) {
+			if (m_loadingPrepared.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				return;
+			if (!m_loadingPrepared.get()) {
+				std::cerr << "Failed to load " << m_loadingPath << std::endl;
+				m_loadingScene.reset();
+				return;
+			}
+		}
+		if (!m_loadingScene->PollUploads())
+			return;
+
+		context.GetDevice().Wait();
+		m_highlightRenderer.ClearSelection();
+		renderContext.scene = std::move(*m_loadingScene);
+		m_loadingScene.reset();
+		renderContext.scene.Finalize(context);
+		OnSceneChanged(context);
+	}
+
+
+	// Renders the frame without opacity culling and keeps a copy of it in m_errorReference
+	inline void RenderErrorReference(CommandContext& context) {
+		const float opacityEpsilon = renderContext.opacityEpsilon;
+		renderContext.opacityEpsilon = 0;
+		CallRendererFn([&](auto& r){ r.Render(context, renderContext); });
+		renderContext.opacityEpsilon = opacityEpsilon;
+
+		const uint2 extent = (uint2)renderContext.renderTarget.Extent();
+		if (!m_errorReference || m_errorReference.size() != extent.x * extent.y)
+			m_errorReference = Buffer::Create(context.GetDevice(), extent.x * extent.y * sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst);
+		if (!m_errorResult) {
+			m_errorResult   = Buffer::Create(context.GetDevice(), 2*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst);
+			m_errorReadback = Buffer::Create(context.GetDevice(), 2*sizeof(uint),
+				vk::BufferUsageFlagBits::eTransferDst,
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+				VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+		}
+		context.Fill(m_errorResult.cast<uint32_t>(), 0u);
+
+		context.AddBarrier(renderContext.renderTarget, Image::ResourceState{
+			.layout = vk::ImageLayout::eTransferSrcOptimal,
+			.stage  = vk::PipelineStageFlagBits2::eTransfer,
+			.access = vk::AccessFlagBits2::eTransferRead,
+			.queueFamily = context.QueueFamily() });
+		context.ExecuteBarriers();
+		context->copyImageToBuffer(
+			**renderContext.renderTarget.GetImage(),
+			vk::ImageLayout::eTransferSrcOptimal,
+			**m_errorReference.mBuffer,
+			vk::BufferImageCopy{
+				.bufferOffset = m_errorReference.mOffset,
+				.bufferRowLength = 0,
+				.bufferImageHeight = 0,
+				.imageSubresource = { vk::ImageAspectFlagBits::eColor, 0, 0, 1 },
+				.imageOffset = { 0, 0, 0 },
+				.imageExtent = { extent.x, extent.y, 1 } });
+		for (const BufferRange<uint>& b : { m_errorReference, m_errorResult })
+			context.AddBarrier(b, {
+				.stage  = vk::PipelineStageFlagBits2::eComputeShader,
+				.access = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite
+			});
+		context.ExecuteBarriers();
+	}
+
+	// Compares the frame that was just rendered with m_errorReference
+	inline void MeasureImageError(CommandContext& context) {
+		const uint2 extent = (uint2)renderContext.renderTarget.Extent();
+		ShaderParameter params = {};
+		params["image"]     = ImageParameter{ .image = renderContext.renderTarget, .imageLayout = vk::ImageLayout::eGeneral };
+		params["reference"] = (BufferParameter)m_errorReference;
+		params["result"]    = (BufferParameter)m_errorResult;
+		params["dim"]       = extent;
+		context.Dispatch(*m_imageErrorPipeline.get(context.GetDevice()), extent, params);
+		context.AddBarrier(m_errorResult, {
+			.stage  = vk::PipelineStageFlagBits2::eTransfer,
+			.access = vk::AccessFlagBits2::eTransferRead
+		});
+		context.ExecuteBarriers();
+		context->copyBuffer(**m_errorResult.mBuffer, **m_errorReadback.mBuffer,
+			vk::BufferCopy{ m_errorResult.mOffset, m_errorReadback.mOffset, 2*sizeof(uint) });
+		m_errorExtent = extent;
+	}
+
+	// PSNR of the last measured frame against the same frame without opacity culling
+	inline double OpacityErrorPSNR() const {
+		const uint64_t sse = m_errorReadback.data()[0] | (uint64_t(m_errorReadback.data()[1]) << 32);
+		if (sse == 0)
+			return std::numeric_limits<double>::infinity();
+		return 10.0 * std::log10(255.0 * 255.0 / ((double)sse / (3.0 * m_errorExtent.x * m_errorExtent.y)));
+	}
 
 	template<size_t I>
 	inline auto CallRendererFn_(auto&& fn, uint32_t idx) {
@@ -48,25 +171,107 @@ public:
 	RenderContext renderContext;
 	inline void LoadScene(CommandContext& context, const std::filesystem::path& p) {
 		renderContext.scene.Load(context, p);
-		if (renderContext.scene.VertexCount() > 0) {
-			renderContext.PrepareScene(context, renderContext.scene.GetShaderParameter());
-			m_highlightRenderer.PrepareBuffers(context, renderContext.scene);
+		OnSceneChanged(context);
+	}
+
+	// Loads p on a worker thread while the current scene keeps rendering.
+	// The new scene replaces it in the first frame after its uploads complete.
+	inline void LoadSceneAsync(CommandContext& context, const std::filesystem::path& p) {
+		if (m_loadingScene) {
+			std::cerr << "Already loading " << m_loadingPath << std::endl;
+			return;
 		}
+		m_loadingScene = std::make_unique<TetrahedronScene>();
+		m_loadingScene->CopyLoadSettings(renderContext.scene);
+		m_loadingPath = p;
+		m_loadingPrepared = std::async(std::launch::async,
+			[scene = m_loadingScene.get(), &device = context.GetDevice(), queueFamily = context.QueueFamily(), p]() {
+				return scene->Prepare(device, queueFamily, p);
+			});
+	}
+	inline bool IsLoading() const { return (bool)m_loadingScene; }
+
+	inline uint32_t RendererCount() const { return (uint32_t)std::tuple_size_v<decltype(renderers)>; }
+	inline const char* RendererName(const uint32_t idx) { return CallRendererFn([](const auto& r) { return r.Name(); }, idx); }
+	inline void SetRenderer(const uint32_t idx) { rendererIndex = idx; }
+
+	// Recreates the render target only when the *render* extent changes
+	inline void ResizeRenderTarget(CommandContext& context, const uint2 extent) {
+		if (!renderContext.renderTarget || renderContext.renderTarget.Extent().x != extent.x || renderContext.renderTarget.Extent().y != extent.y) {
+			renderContext.renderTarget = ImageView::Create(
+				Image::Create(context.GetDevice(), ImageInfo{
+					.format = vk::Format::eR8G8B8A8Unorm,
+					.extent = uint3(extent, 1),
+					.usage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eStorage,
+					.queueFamilies = { context.QueueFamily() } }),
+				vk::ImageSubresourceRange{
+					.aspectMask = vk::ImageAspectFlagBits::eColor,
+					.baseMipLevel = 0,
+					.levelCount = 1,
+					.baseArrayLayer = 0,
+					.layerCount = 1 });
+		}
+	}
+
+	// Renders the current camera into the render target without any GUI or gizmo interaction.
+	inline void RenderOffscreen(CommandContext& context, const uint2 extent) {
+		ResizeRenderTarget(context, extent);
+		if (renderContext.scene.TetCount() == 0) {
+			context.ClearColor(renderContext.renderTarget, vk::ClearColorValue{std::array<float,4>{ 0, 0, 0, 0 }});
+			return;
+		}
+		CallRendererFn([&](auto& r){ r.Render(context, renderContext); });
 	}
 
 	inline void DrawPropertiesGui(CommandContext& context) {
+		if (m_loadingScene) {
+			ImGui::Text("Loading %s", m_loadingPath.filename().string().c_str());
+			if (m_loadingPrepared.valid())
+				ImGui::ProgressBar(0.f, ImVec2(-1, 0), "Reading");
+			else
+				ImGui::ProgressBar(m_loadingScene->LoadProgress(), ImVec2(-1, 0), "Uploading");
+		}
+
 		if (ImGui::CollapsingHeader("Camera")) {
 			renderContext.camera.DrawInspectorGui();
 		}
 
 		if (ImGui::CollapsingHeader("Scene")) {
 			renderContext.scene.DrawGui(context);
+			// format and load option changes reload the scene like opening it again
+			if (renderContext.scene.TakeReloadRequest())
+				LoadSceneAsync(context, renderContext.scene.SourcePath());
 		}
 
 		if (ImGui::CollapsingHeader("Renderer")) {
 			if (renderContext.renderTarget) {
 				ImGui::Text("%u x %u", renderContext.renderTarget.Extent().x, renderContext.renderTarget.Extent().y);
 			}
+			if (renderContext.scene.TetCount() > 0) {
+				ImGui::Text("%u visible tets, sorting %u", renderContext.VisibleCount(), renderContext.SortCount());
+				ImGui::Text("%u / %u clusters visible", renderContext.VisibleClusterCount(), renderContext.scene.ClusterCount());
+			}
+			ImGui::Checkbox("Cluster culling", &renderContext.clusterCulling);
+			ImGui::Checkbox("Occlusion culling", &renderContext.occlusionCulling);
+			if (renderContext.occlusionCulling) {
+				ImGui::Checkbox("Conservative", &renderContext.occlusionConservative);
+				ImGui::SliderFloat("Saturated below", &renderContext.occlusionEpsilon, 0.f, 0.1f, "%.4f", ImGuiSliderFlags_Logarithmic);
+				ImGui::Text("%u occluded tets", renderContext.OccludedCount());
+			}
+			ImGui::SliderFloat("Min opacity", &renderContext.opacityEpsilon, 0.f, 0.05f, "%.4f", ImGuiSliderFlags_Logarithmic);
+			if (renderContext.opacityEpsilon > 0) {
+				ImGui::Text("%u transparent tets culled", renderContext.TransparentCount());
+				if (ImGui::Button("Measure error"))
+					m_measureOpacityError = true;
+				if (m_errorExtent.x > 0) {
+					ImGui::SameLine();
+					ImGui::Text("PSNR %.1f dB vs no opacity culling", OpacityErrorPSNR());
+				}
+			}
+			if (renderContext.scene.TetCount() > 0) {
+				const float2 overdraw = renderContext.Overdraw();
+				ImGui::Text("Overdraw %.1fx, %.1fx after occlusion and opacity culling", overdraw.x, overdraw.y);
+			}
 
 			if (ImGui::BeginCombo("Mode", CallRendererFn([](const auto& r) { return r.Name(); }))) {
 				auto drawComboItem = [&](const auto& r, uint32_t i) {
@@ -88,6 +293,9 @@ public:
 	}
 
 	void DrawWidgetGui(CommandContext& context, const double dt) {
+		// before anything is recorded, so this frame never references the old scene after a swap
+		UpdateLoading(context);
+
 		// Get the size of the ImGui viewport for display
 		const float2 displayExtentf = std::bit_cast<float2>(ImGui::GetWindowContentRegionMax()) - std::bit_cast<float2>(ImGui::GetWindowContentRegionMin());
 
@@ -103,21 +311,7 @@ public:
 
 		if (renderExtent.x == 0 || renderExtent.y == 0) return;
 
-		// Resize the render target only when the *render* extent changes
-		if (!renderContext.renderTarget || renderContext.renderTarget.Extent().x != renderExtent.x || renderContext.renderTarget.Extent().y != renderExtent.y) {
-			renderContext.renderTarget = ImageView::Create(
-				Image::Create(context.GetDevice(), ImageInfo{
-					.format = vk::Format::eR8G8B8A8Unorm,
-					.extent = uint3(renderExtent, 1), // Use renderExtent here
-					.usage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eStorage,
-					.queueFamilies = { context.QueueFamily() } }),
-				vk::ImageSubresourceRange{
-					.aspectMask = vk::ImageAspectFlagBits::eColor,
-					.baseMipLevel = 0,
-					.levelCount = 1,
-					.baseArrayLayer = 0,
-					.layerCount = 1 });
-		}
+		ResizeRenderTarget(context, renderExtent);
 
 		// Draw the renderTarget image, scaling it to the ImGui window size
 		ImGui::Image(Gui::GetTextureID(renderContext.renderTarget, vk::Filter::eNearest), std::bit_cast<ImVec2>(displayExtentf));
@@ -178,7 +372,13 @@ public:
 			context.ClearColor(renderContext.renderTarget, vk::ClearColorValue{std::array<float,4>{ 0, 0, 0, 0 }});
 		} else {
 			context.PushDebugLabel("DelaunayTetRenderer::Render");
+			const bool measureError = m_measureOpacityError && renderContext.opacityEpsilon > 0;
+			if (measureError)
+				RenderErrorReference(context);
 			CallRendererFn([&](auto& r){ r.Render(context, renderContext); });
+			if (measureError)
+				MeasureImageError(context);
+			m_measureOpacityError = false;
 			context.PopDebugLabel();
 		}
 
@@ -52,6 +52,7 @@ void initLa(
     const std::vector<uint32_t>& user_handles)
 {
     if (user_handles.empty()) return;
+    const vkDelTet::CsrTable& adjacency = scene.Adjacency();
     float cell_size = radius; // Cell size should be equal to the search radius
 
     std::unordered_map<int3, std::vector<uint32_t>, Int3Hasher> handle_grid;
@@ -82,7 +83,7 @@ void initLa(
         uint32_t current_v = q.front();
         q.pop();
 
-        for (uint32_t neighbor_idx : scene.adjacency[current_v]) {
+        for (uint32_t neighbor_idx : adjacency[current_v]) {
             if (visited[neighbor_idx]) continue;
             
             // OPTIMIZED: Check if neighbor is within radius using the spatial grid
@@ -155,7 +156,7 @@ void initLa(
         } else {
             // This is a free vertex, apply Laplacian rule
             double degree = 0;
-            for (uint32_t neighbor_global_idx : scene.adjacency[global_idx]) {
+            for (uint32_t neighbor_global_idx : adjacency[global_idx]) {
                 // Only consider neighbors that are part of our sub-problem
                 if (context.global_to_local_idx_map.count(neighbor_global_idx)) {
                     uint32_t neighbor_local_idx = context.global_to_local_idx_map.at(neighbor_global_idx);
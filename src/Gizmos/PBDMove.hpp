@@ -70,6 +70,9 @@ void initPBD(
         return;
     }
 
+    const vkDelTet::CsrTable& adjacency      = scene.Adjacency();
+    const vkDelTet::CsrTable& vertex_to_tets = scene.VertexToTets();
+
     // --- 1. Identify Active and Boundary Vertices ---
     std::set<uint32_t> active_set;
     std::set<uint32_t> boundary_set;
@@ -104,7 +107,7 @@ void initPBD(
         uint32_t current_v = q.front();
         q.pop();
 
-        for (uint32_t neighbor_idx : scene.adjacency[current_v]) {
+        for (uint32_t neighbor_idx : adjacency[current_v]) {
             if (visited[neighbor_idx]) continue;
             
             // Check if this neighbor is within the radius of ANY handle
@@ -190,9 +193,9 @@ void initPBD(
 
     for (uint32_t global_idx : simulation_vertices) {
         // For each vertex in our island, check its incident tetrahedra
-        if (scene.vertex_to_tets.size() <= global_idx) continue; // Safety check
+        if (vertex_to_tets.size() <= global_idx) continue; // Safety check
 
-        for (uint32_t tet_idx : scene.vertex_to_tets[global_idx]) {
+        for (uint32_t tet_idx : vertex_to_tets[global_idx]) {
             // If we already processed this tet, skip it
             if (processed_tets.count(tet_idx)) continue;
 
@@ -4,14 +4,24 @@
 #include "Scene/TetrahedronScene.hpp"
 #include <Rose/RadixSort/RadixSort.hpp>
 #include <Rose/Sorting/DeviceRadixSort.h>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <vulkan/vulkan_enums.hpp>
 
+// Must match Culling.cs.slang and ScanBench.cs.slang (see Scan.slang)
 #define SCAN_GROUP_SIZE 256
+#define SCAN_ITEMS_PER_THREAD 4
+#define SCAN_TILE_SIZE (SCAN_GROUP_SIZE * SCAN_ITEMS_PER_THREAD)
+
+// Must match Culling.cs.slang and OcclusionPyramid.cs.slang
+#define OCCLUSION_TILE 8
 
 namespace vkDelTet {
 
+// Groups to dispatch for a scan over count elements; the scan state holds 2 + this many uints
+inline uint32_t ScanTileCount(const uint32_t count) { return (count + SCAN_TILE_SIZE - 1) / SCAN_TILE_SIZE; }
+
 // helper for drawing with transmittance in the alpha channel
 struct RenderContext {
 private:
@@ -21,12 +31,71 @@ private:
 	PipelineCache evaluateSHPipeline      = PipelineCache(FindShaderPath("EvaluateSH.cs.slang"));
 
 	PipelineCache markPipeline      = PipelineCache(FindShaderPath("Culling.cs.slang"), "markTets");
-	PipelineCache scanPipeline      = PipelineCache(FindShaderPath("Culling.cs.slang"), "prefix_sum");
 	PipelineCache scatterPipeline      = PipelineCache(FindShaderPath("Culling.cs.slang"), "compact_tets");
+	PipelineCache cullClustersPipeline = PipelineCache(FindShaderPath("Culling.cs.slang"), "cull_clusters");
+	PipelineCache occlusionBasePipeline       = PipelineCache(FindShaderPath("OcclusionPyramid.cs.slang"), "build_base");
+	PipelineCache occlusionDownsamplePipeline = PipelineCache(FindShaderPath("OcclusionPyramid.cs.slang"), "downsample");
 
 	RadixSort radixSort;
 	DeviceRadixSort dRadixSort;
 
+	BufferRange<uint> visibleCountReadback; // host visible copies of scanState[1], clusterScanState[1] and cullStats, then the frame they are from
+	BufferRange<uint> cullStats;            // see markTets in Culling.cs.slang
+	uint32_t          sortCount = 0;
+	uint32_t          frameIndex = 0;       // of the frame being rendered
+	uint32_t          viewFirstFrame = 0;   // first frame rendered with the current frameViewProjection
+
+	// pyramid of the last frame rendered with occlusion culling on, see OcclusionPyramid.cs.slang
+	BufferRange<float2> occlusionPyramid;
+	BufferRange<uint>   frontDepth;
+	std::vector<uint2>  occlusionLevels;  // extent of each level, level 0 first
+	uint2               occlusionImageExtent = uint2(0);
+	float4x4            frameViewProjection;     // of the frame being rendered
+	float4x4            occlusionViewProjection; // of the frame occlusionPyramid was built from
+	bool                occlusionValid = false;
+
+	inline void AllocateOcclusion(CommandContext& context, const uint2 extent) {
+		if (occlusionPyramid && all(equal(extent, occlusionImageExtent)))
+			return;
+		occlusionImageExtent = extent;
+		occlusionLevels = { max((extent + uint2(OCCLUSION_TILE - 1)) / uint2(OCCLUSION_TILE), uint2(1)) };
+		while (occlusionLevels.back().x > 1 || occlusionLevels.back().y > 1)
+			occlusionLevels.push_back(max((occlusionLevels.back() + uint2(1)) / uint2(2), uint2(1)));
+		size_t texels = 0;
+		for (const uint2 e : occlusionLevels)
+			texels += e.x * e.y;
+		occlusionPyramid = Buffer::Create(context.GetDevice(), texels*sizeof(float2), vk::BufferUsageFlagBits::eStorageBuffer);
+		frontDepth       = Buffer::Create(context.GetDevice(), occlusionLevels[0].x*occlusionLevels[0].y*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst);
+		occlusionValid   = false;
+	}
+
+	// Builds the pyramid from the transmittance in renderTarget and the front depths markTets recorded
+	inline void BuildOcclusionPyramid(CommandContext& context) {
+		ShaderParameter params = {};
+		params["image"]       = ImageParameter{ .image = renderTarget, .imageLayout = vk::ImageLayout::eGeneral };
+		params["frontDepth"]  = (BufferParameter)frontDepth;
+		params["pyramid"]     = (BufferParameter)occlusionPyramid;
+		params["imageExtent"] = occlusionImageExtent;
+		params["dstExtent"]   = occlusionLevels[0];
+		context.Dispatch(*occlusionBasePipeline.get(context.GetDevice()), occlusionLevels[0], params);
+		uint32_t offset = 0;
+		for (size_t i = 1; i < occlusionLevels.size(); i++) {
+			context.AddBarrier(occlusionPyramid, {
+				.stage  = vk::PipelineStageFlagBits2::eComputeShader,
+				.access = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite
+			});
+			context.ExecuteBarriers();
+			params["srcExtent"] = occlusionLevels[i - 1];
+			params["srcOffset"] = offset;
+			offset += occlusionLevels[i - 1].x * occlusionLevels[i - 1].y;
+			params["dstExtent"] = occlusionLevels[i];
+			params["dstOffset"] = offset;
+			context.Dispatch(*occlusionDownsamplePipeline.get(context.GetDevice()), occlusionLevels[i], params);
+		}
+		occlusionViewProjection = frameViewProjection;
+		occlusionValid = true;
+	}
+
 public:
 	std::optional<uint2> overrideResolution;
 	TetrahedronScene    scene;
@@ -34,13 +103,29 @@ public:
 	BufferRange<uint>   sortKeys;
 	BufferRange<uint>   sortPayloads;
 	BufferRange<uint2>   sortBuffer;
-	BufferRange<float3> evaluatedColors;
+	BufferRange<std::byte> evaluatedColors; // layout depends on scene.GetPrecision().colors
 	ImageView           renderTarget;
 	BufferRange<uint>  markedTets;
 	BufferRange<uint>  drawArgs;
 	BufferRange<uint>  insDrawArgs;
 	BufferRange<uint>  meshDrawArgs;
-	BufferRange<uint>  blockSumAtomicCounter;
+	BufferRange<uint>  shDispatchArgs;
+	BufferRange<uint>  scanState; // see compact_tets in Culling.cs.slang
+	// Cluster culling (see TetClusters.hpp): per-cluster visibility read by markTets, and the ids of the
+	// visible clusters with clusterDrawArgs = { count, count, 1, 1 } for per-cluster indirect draws
+	bool               clusterCulling = true;
+	BufferRange<uint>  clusterVisibility;
+	BufferRange<uint>  visibleClusters;
+	BufferRange<uint>  clusterDrawArgs;
+	BufferRange<uint>  clusterScanState;
+	// Occlusion culling against the previous frame's transmittance (see OcclusionPyramid.cs.slang). Tets
+	// behind the front depth of saturated texels are culled. Conservative mode pads the footprint by a
+	// texel and only counts tets that are opaque by themselves as occluders, over the texels they cover whole.
+	bool               occlusionCulling      = false;
+	bool               occlusionConservative = true;
+	float              occlusionEpsilon      = 1.f / 255.f; // transmittance below which a pixel is saturated
+	// Tets whose opacity along any ray stays below this are culled before sorting; 0 disables it
+	float              opacityEpsilon        = 0.f;
 
 	constexpr vk::PipelineColorBlendAttachmentState GetBlendState() {
 		return vk::PipelineColorBlendAttachmentState {
@@ -54,9 +139,15 @@ public:
 			.colorWriteMask      = vk::ColorComponentFlags{vk::FlagTraits<vk::ColorComponentFlagBits>::allFlags} };
 	}
 
+	// The color precision can change without a reload, so this is also checked every frame
+	inline void AllocateColors(CommandContext& context) {
+		const size_t colorBytes = scene.TetCount() * scene.GetPrecision().ColorSize();
+		if (!evaluatedColors || evaluatedColors.size_bytes() != colorBytes)
+			evaluatedColors = Buffer::Create(context.GetDevice(), colorBytes, vk::BufferUsageFlagBits::eStorageBuffer);
+	}
+
 	inline void PrepareScene(CommandContext& context, const ShaderParameter& sceneParams) {
-		if (!evaluatedColors || evaluatedColors.size() != scene.TetCount())
-			evaluatedColors = Buffer::Create(context.GetDevice(), scene.TetCount()*sizeof(float3), vk::BufferUsageFlagBits::eStorageBuffer);
+		AllocateColors(context);
 
 		if (!sortKeys || sortKeys.size() != scene.TetCount())
 			sortKeys = Buffer::Create(context.GetDevice(), scene.TetCount()*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer);
@@ -66,9 +157,33 @@ public:
 			sortPayloads = Buffer::Create(context.GetDevice(), scene.TetCount()*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer);
 		if (!markedTets || markedTets.size() != scene.TetCount())
 			markedTets = Buffer::Create(context.GetDevice(), scene.TetCount()*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer);
-		uint num_groups = (scene.TetCount() + SCAN_GROUP_SIZE - 1) / SCAN_GROUP_SIZE;
-		if (!blockSumAtomicCounter || blockSumAtomicCounter.size() != 1)
-			blockSumAtomicCounter = Buffer::Create(context.GetDevice(), sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst);
+		const uint32_t numTiles = ScanTileCount(scene.TetCount());
+		if (!scanState || scanState.size() != 2 + numTiles)
+			scanState = Buffer::Create(context.GetDevice(), (2 + numTiles)*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst);
+		const uint32_t numClusters = scene.ClusterCount();
+		if (!clusterVisibility || clusterVisibility.size() != numClusters) {
+			clusterVisibility = Buffer::Create(context.GetDevice(), numClusters*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer);
+			visibleClusters   = Buffer::Create(context.GetDevice(), numClusters*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer);
+			clusterScanState  = Buffer::Create(context.GetDevice(), (2 + ScanTileCount(numClusters))*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst);
+		}
+		if (!cullStats)
+			cullStats = Buffer::Create(context.GetDevice(), 4*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst);
+		occlusionValid = false;
+		if (!clusterDrawArgs)
+			clusterDrawArgs = Buffer::Create(context.GetDevice(), 4*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer);
+		if (!shDispatchArgs)
+			shDispatchArgs = Buffer::Create(context.GetDevice(), 3*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer);
+		if (!visibleCountReadback) {
+			visibleCountReadback = Buffer::Create(context.GetDevice(), 7*sizeof(uint),
+				vk::BufferUsageFlagBits::eTransferDst,
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+				VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+		}
+		// sort everything until a count has been read back
+		visibleCountReadback.data()[0] = scene.TetCount();
+		visibleCountReadback.data()[1] = numClusters;
+		std::fill_n(visibleCountReadback.data() + 2, 4, 0u);
+		visibleCountReadback.data()[6] = frameIndex;
 		if (!meshDrawArgs || meshDrawArgs.size() != 3)
 			meshDrawArgs = Buffer::Create(context.GetDevice(), 4*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer);
 		if (!drawArgs || drawArgs.size() != 4)
@@ -77,12 +192,43 @@ public:
 			insDrawArgs = Buffer::Create(context.GetDevice(), 5*sizeof(uint), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer);
 
 		ShaderParameter params = {};
-		params["numSpheres"]   = scene.TetCount();
+		params["numPairs"]     = scene.TetCount();
 		params["sortKeys"] = (BufferParameter)sortKeys;
 		params["sortPayloads"] = (BufferParameter)sortPayloads;
 		createSortPairsPipeline(context, uint3(scene.TetCount(), 1u, 1u), params);
 	}
 
+	// Visible tets in a recent frame, and how many sort pairs the current frame sorts
+	inline uint32_t VisibleCount() const { return visibleCountReadback ? std::min(visibleCountReadback.data()[0], scene.TetCount()) : 0; }
+	inline uint32_t VisibleClusterCount() const { return visibleCountReadback ? std::min(visibleCountReadback.data()[1], scene.ClusterCount()) : 0; }
+	// Tets the occlusion test removed in a recent frame, and the estimated overdraw (summed footprint
+	// of the tets over the pixel count) before and after the occlusion and opacity tests
+	inline uint32_t OccludedCount() const { return visibleCountReadback ? visibleCountReadback.data()[2] : 0; }
+	// Tets culled in a recent frame because their opacity bound was below opacityEpsilon
+	inline uint32_t TransparentCount() const { return visibleCountReadback ? visibleCountReadback.data()[5] : 0; }
+	inline float2   Overdraw() const {
+		if (!visibleCountReadback || !renderTarget)
+			return float2(0);
+		const float pixels = (float)renderTarget.Extent().x * (float)renderTarget.Extent().y;
+		return float2(visibleCountReadback.data()[3], visibleCountReadback.data()[4]) / pixels;
+	}
+	inline uint32_t SortCount()    const { return sortCount; }
+
+	// The radix sort is sized on the host, so it covers the visible count of a completed frame plus
+	// some headroom. That count is only used if the frame was rendered from the current view; until
+	// one has completed (after the camera moves, or for renders queued in one submission) it is stale,
+	// and everything is sorted. Headroom covers the few tets culling changes (e.g. occlusion) add.
+	inline void UpdateSortCount() {
+		if ((int32_t)(visibleCountReadback.data()[6] - viewFirstFrame) < 0) {
+			sortCount = scene.TetCount();
+			return;
+		}
+		const uint32_t visible = VisibleCount();
+		// a few distinct sizes, so the sort doesn't see a new size every frame
+		const uint32_t step = std::max<uint32_t>(scene.TetCount() / 32, SCAN_TILE_SIZE);
+		sortCount = std::min<uint32_t>(scene.TetCount(), (visible + visible / 4 + step) / step * step);
+	}
+
 	inline void PrepareRender(CommandContext& context, const float3 rayOrigin, bool prepareSH=true) {
 		{
 			context.PushDebugLabel("Cull");
@@ -91,65 +237,181 @@ public:
 			ShaderParameter params = {};
 			params["scene"] = scene.GetShaderParameter();
 
-			uint32_t numBlocks = (scene.TetCount() + SCAN_GROUP_SIZE - 1) / SCAN_GROUP_SIZE;
+			uint32_t numBlocks = ScanTileCount(scene.TetCount());
 			const float4x4 cameraToWorld = camera.GetCameraToWorld();
 			const float4x4 sceneToWorld  = scene.Transform();
 			const float4x4 worldToScene  = inverse(sceneToWorld);
 			const float4x4 sceneToCamera = inverse(cameraToWorld) * sceneToWorld;
+			scene.UpdateResidency(context, projection * sceneToCamera, rayOrigin); // streamed bricks land before anything reads the pool
 			params["viewProjection"] = projection * sceneToCamera;
 			params["invProjection"] = inverse(projection * sceneToCamera);
 			params["rayOrigin"] = rayOrigin;
+			const float4x4 viewProjection = projection * sceneToCamera;
+			frameIndex++;
+			if (std::memcmp(&viewProjection, &frameViewProjection, sizeof(float4x4)) != 0)
+				viewFirstFrame = frameIndex;
+			frameViewProjection = viewProjection;
+
+			// the pyramid of the previous frame, if it was rendered with occlusion culling at this extent
+			AllocateOcclusion(context, extent);
+			if (!occlusionCulling)
+				occlusionValid = false;
+			params["occlusionViewProjection"] = occlusionViewProjection;
+			params["occlusionTest"]           = occlusionValid ? 1u : 0u;
+			params["occlusionRecord"]         = occlusionCulling ? 1u : 0u;
+			params["occlusionConservative"]   = occlusionConservative ? 1u : 0u;
+			params["occlusionEpsilon"]        = occlusionEpsilon;
+			params["occlusionExtent"]         = occlusionLevels[0];
+			params["occlusionLevels"]         = (uint32_t)occlusionLevels.size();
+			params["occlusionPyramid"]        = (BufferParameter)occlusionPyramid;
+			params["frontDepth"]              = (BufferParameter)frontDepth;
+			params["cullStats"]               = (BufferParameter)cullStats;
+			params["opacityEpsilon"]          = opacityEpsilon;
+			context.Fill(frontDepth.cast<uint32_t>(), 0x7F800000u); // +inf
+			context.Fill(cullStats.cast<uint32_t>(), 0u);
+			context.AddBarrier(frontDepth, {
+				.stage  = vk::PipelineStageFlagBits2::eComputeShader,
+				.access = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite
+			});
+			context.AddBarrier(cullStats, {
+				.stage  = vk::PipelineStageFlagBits2::eComputeShader,
+				.access = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite
+			});
 
 			params["markedTets"] = (BufferParameter)markedTets;
 			params["drawArgs"] = (BufferParameter)drawArgs;
 			params["insDrawArgs"] = (BufferParameter)insDrawArgs;
 			params["meshDrawArgs"] = (BufferParameter)meshDrawArgs;
-			params["blockSumAtomicCounter"] = (BufferParameter)blockSumAtomicCounter;
+			params["scanState"] = (BufferParameter)scanState;
+			params["sortPayloads"] = (BufferParameter)sortPayloads;
+			params["shDispatchArgs"] = (BufferParameter)shDispatchArgs;
 			params["numBlocks"] = numBlocks;
 			params["outputResolution"] = (float2)extent;
+			params["clusterVisibility"] = (BufferParameter)clusterVisibility;
+
+			// clusters first, so markTets only transforms the vertices of tets in visible clusters
+			{
+				const uint32_t numClusters = scene.ClusterCount();
+				ShaderParameter clusterParams = params;
+				clusterParams["numClusters"]     = numClusters;
+				clusterParams["numClusterTiles"] = ScanTileCount(numClusters);
+				clusterParams["clusterCulling"]  = clusterCulling ? 1u : 0u;
+				clusterParams["clusters"]        = (BufferParameter)scene.TetClusters();
+				clusterParams["visibleClusters"] = (BufferParameter)visibleClusters;
+				clusterParams["clusterDrawArgs"] = (BufferParameter)clusterDrawArgs;
+				clusterParams["scanState"]       = (BufferParameter)clusterScanState;
+
+				context.Fill(clusterScanState.cast<uint32_t>(), 0u);
+				context.AddBarrier(clusterScanState, {
+					.stage  = vk::PipelineStageFlagBits2::eComputeShader,
+					.access = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite
+				});
+				context.ExecuteBarriers();
+				Pipeline& cullClusters = *cullClustersPipeline.get(context.GetDevice());
+				auto descriptorSets = context.GetDescriptorSets(*cullClusters.Layout());
+				context.UpdateDescriptorSets(*descriptorSets, clusterParams, *cullClusters.Layout());
+				context.Dispatch(cullClusters, ScanTileCount(numClusters) * SCAN_GROUP_SIZE, *descriptorSets);
+
+				context.AddBarrier(clusterVisibility, {
+					.stage  = vk::PipelineStageFlagBits2::eComputeShader,
+					.access = vk::AccessFlagBits2::eShaderRead
+				});
+				context.AddBarrier(clusterScanState, {
+					.stage  = vk::PipelineStageFlagBits2::eTransfer,
+					.access = vk::AccessFlagBits2::eTransferRead
+				});
+				context.AddBarrier(clusterDrawArgs, {
+					.stage  = vk::PipelineStageFlagBits2::eDrawIndirect,
+					.access = vk::AccessFlagBits2::eIndirectCommandRead
+				});
+				context.ExecuteBarriers();
+				context->copyBuffer(**clusterScanState.mBuffer, **visibleCountReadback.mBuffer,
+					vk::BufferCopy{ clusterScanState.mOffset + sizeof(uint), visibleCountReadback.mOffset + sizeof(uint), sizeof(uint) });
+			}
 
 
 			Pipeline& mark = *markPipeline.get(context.GetDevice());
 			auto descriptorSets1 = context.GetDescriptorSets(*mark.Layout());
 			context.UpdateDescriptorSets(*descriptorSets1, params, *mark.Layout());
 			context.Dispatch(mark, scene.TetCount(), *descriptorSets1);
-			context.Fill(blockSumAtomicCounter.cast<uint32_t>(), 0u);
+			context.Fill(scanState.cast<uint32_t>(), 0u);
 
 			context.AddBarrier(markedTets, {
 				.stage  = vk::PipelineStageFlagBits2::eComputeShader,
 				.access = vk::AccessFlagBits2::eShaderRead
 			});
+			context.AddBarrier(cullStats, {
+				.stage  = vk::PipelineStageFlagBits2::eTransfer,
+				.access = vk::AccessFlagBits2::eTransferRead
+			});
+			context.AddBarrier(frontDepth, {
+				.stage  = vk::PipelineStageFlagBits2::eComputeShader,
+				.access = vk::AccessFlagBits2::eShaderRead
+			});
+			context.AddBarrier(scanState, {
+				.stage  = vk::PipelineStageFlagBits2::eComputeShader,
+				.access = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eShaderWrite
+			});
 			context.ExecuteBarriers();
 
-			Pipeline& scan = *scanPipeline.get(context.GetDevice());
-			auto descriptorSets2 = context.GetDescriptorSets(*scan.Layout());
-			context.UpdateDescriptorSets(*descriptorSets2, params, *scan.Layout());
-			context.Dispatch(scan, scene.TetCount(), *descriptorSets2);
-			context.AddBarrier(blockSumAtomicCounter, {
+			// mark -> scan -> scatter: the visible tets end up at the front of sortPayloads
+			Pipeline& scatter = *scatterPipeline.get(context.GetDevice());
+			auto descriptorSets2 = context.GetDescriptorSets(*scatter.Layout());
+			context.UpdateDescriptorSets(*descriptorSets2, params, *scatter.Layout());
+			context.Dispatch(scatter, numBlocks * SCAN_GROUP_SIZE, *descriptorSets2);
+			context.AddBarrier(scanState, {
+				.stage  = vk::PipelineStageFlagBits2::eComputeShader | vk::PipelineStageFlagBits2::eTransfer,
+				.access = vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eTransferRead
+			});
+			context.AddBarrier(sortPayloads, {
 				.stage  = vk::PipelineStageFlagBits2::eComputeShader,
 				.access = vk::AccessFlagBits2::eShaderRead
 			});
+			for (const BufferRange<uint>& args : { drawArgs, insDrawArgs, meshDrawArgs, shDispatchArgs })
+				context.AddBarrier(args, {
+					.stage  = vk::PipelineStageFlagBits2::eDrawIndirect,
+					.access = vk::AccessFlagBits2::eIndirectCommandRead
+				});
 			context.ExecuteBarriers();
+
+			// read by UpdateSortCount once this frame is done
+			context->copyBuffer(**scanState.mBuffer, **visibleCountReadback.mBuffer,
+				vk::BufferCopy{ scanState.mOffset + sizeof(uint), visibleCountReadback.mOffset, sizeof(uint) });
+			context->copyBuffer(**cullStats.mBuffer, **visibleCountReadback.mBuffer,
+				vk::BufferCopy{ cullStats.mOffset, visibleCountReadback.mOffset + 2*sizeof(uint), 4*sizeof(uint) });
+			// stamped after the copies, so the host never pairs this frame with older counts
+			context->pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer,
+				vk::PipelineStageFlagBits::eTransfer,
+				{},
+				vk::MemoryBarrier{
+					.srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+					.dstAccessMask = vk::AccessFlagBits::eTransferWrite },
+				{}, {});
+			context->fillBuffer(**visibleCountReadback.mBuffer, visibleCountReadback.mOffset + 6*sizeof(uint), sizeof(uint), frameIndex);
 		}
 
 		// Sort tetrahedra by power of circumsphere
 		{
 			context.PushDebugLabel("Sort");
 
+			UpdateSortCount();
 			ShaderParameter params = {};
 			params["spheres"]    = (BufferParameter)scene.TetCircumspheres();
-			params["numSpheres"] = (uint32_t)scene.TetCircumspheres().size();
+			params["numPairs"]   = sortCount;
 			params["sortKeys"] = (BufferParameter)sortKeys;
 			params["sortPayloads"] = (BufferParameter)sortPayloads;
 			params["rayOrigin"] = rayOrigin;
-			params["markedTets"] = (BufferParameter)markedTets;
+			params["scanState"] = (BufferParameter)scanState;
 
 			Pipeline& updateSortPairs = *updateSortPairsPipeline.get(context.GetDevice());
 			auto descriptorSets = context.GetDescriptorSets(*updateSortPairs.Layout());
 			context.UpdateDescriptorSets(*descriptorSets, params, *updateSortPairs.Layout());
-			context.Dispatch(updateSortPairs, scene.TetCount(), *descriptorSets);
+			context.Dispatch(updateSortPairs, sortCount, *descriptorSets);
 
-			dRadixSort(context, sortKeys, sortPayloads);
+			BufferRange<uint> keys     = sortKeys.slice(0, sortCount);
+			BufferRange<uint> payloads = sortPayloads.slice(0, sortCount);
+			dRadixSort(context, keys, payloads);
 
 			context.PopDebugLabel();
 		}
@@ -157,6 +419,7 @@ public:
 		// evaluate tet SH coefficients
 		if (prepareSH) {
 			context.PushDebugLabel("EvaluateSH");
+			AllocateColors(context);
 
 			ShaderParameter params = {};
 			params["scene"]            = scene.GetShaderParameter();
@@ -164,17 +427,19 @@ public:
 				params["shCoeffs"][i] = (BufferParameter)scene.TetSH()[i];
 			params["outputColors"]    = (BufferParameter)evaluatedColors;
 			params["tetCentroids"]    = (BufferParameter)scene.TetCentroids();
-			params["tetOffsets"]    = (BufferParameter)scene.TetOffsets();
 			params["rayOrigin"] = rayOrigin;
-			params["numPrimitives"] = scene.TetCount();
-			params["markedTets"] = (BufferParameter)markedTets;
-
-			evaluateSHPipeline(
-				context,
-				uint3(scene.TetCount(), 1u, 1u),
-				params,
-				ShaderDefines{ { "NUM_COEFFS", std::to_string(scene.NumSHCoeffs()) }}
-			);
+			params["sortPayloads"] = (BufferParameter)sortPayloads;
+			params["scanState"] = (BufferParameter)scanState;
+
+			// one thread per visible tet
+			Pipeline& evaluateSH = *evaluateSHPipeline.get(context.GetDevice(), ShaderDefines{
+				{ "NUM_COEFFS", std::to_string(scene.NumSHCoeffs()) },
+				{ "SH_FORMAT",  std::to_string((uint32_t)scene.GetSHFormat()) } });
+			auto descriptorSets = context.GetDescriptorSets(*evaluateSH.Layout());
+			context.UpdateDescriptorSets(*descriptorSets, params, *evaluateSH.Layout());
+			context->bindPipeline(vk::PipelineBindPoint::eCompute, **evaluateSH);
+			context.BindDescriptors(*evaluateSH.Layout(), *descriptorSets);
+			context->dispatchIndirect(**shDispatchArgs.mBuffer, shDispatchArgs.mOffset);
 
 			context.PopDebugLabel();
 		}
@@ -244,6 +509,9 @@ public:
 			params["dim"] = extent;
 			context.Dispatch(*computeAlphaPipeline.get(context.GetDevice()), extent, params);
 		}
+
+		if (occlusionCulling && occlusionPyramid)
+			BuildOcclusionPyramid(context);
 	}
 };
 
@@ -18,7 +18,8 @@ private:
     });
 
     inline Pipeline& GetPipeline(CommandContext& context, RenderContext& renderContext) {
-        ShaderDefines defines {};
+        ShaderDefines defines {
+            { "SH_FORMAT", std::to_string((uint32_t)renderContext.scene.GetSHFormat()) } };
 
         GraphicsPipelineInfo pipelineInfo {
             .vertexInputState = VertexInputDescription{},
@@ -94,7 +95,6 @@ public:
             for (uint32_t i = 0; i < renderContext.scene.TetSH().size(); i++)
                     params["shCoeffs"][i] = (BufferParameter)renderContext.scene.TetSH()[i];
             params["tetCentroids"]    = (BufferParameter)renderContext.scene.TetCentroids();
-            params["tetOffsets"]    = (BufferParameter)renderContext.scene.TetOffsets();
 
             context.UpdateDescriptorSets(*descriptorSets, params, *pipeline.Layout());
         }
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include <Rose/Core/RoseEngine.h>
+
+#include "Parallel.hpp"
+
+namespace vkDelTet {
+
+using namespace RoseEngine;
+
+// Out-of-core rendering splits the spatially ordered tets into bricks of kBrickTets consecutive
+// tets. Consecutive tets along the Morton curve are close together, so each brick is compact.
+// The GPU holds a fixed pool of brick slots and BrickResidency decides which bricks occupy them.
+static constexpr uint32_t kBrickTets = 1 << 14;
+
+// Layout of PackedSectionType::eBricks
+struct Brick {
+	float3   aabbMin;
+	uint32_t firstTet;
+	float3   aabbMax;
+	uint32_t tetCount;
+};
+
+inline std::vector<Brick> BuildBricks(const std::span<const float3> vertices, const std::span<const uint4> indices, const uint32_t brickTets = kBrickTets) {
+	std::vector<Brick> bricks((indices.size() + brickTets - 1) / brickTets);
+	ParallelFor(bricks.size(), [&](size_t begin, size_t end) {
+		for (size_t b = begin; b < end; b++) {
+			Brick& brick = bricks[b];
+			brick.firstTet = (uint32_t)(b * brickTets);
+			brick.tetCount = (uint32_t)std::min<size_t>(brickTets, indices.size() - brick.firstTet);
+			brick.aabbMin = float3( FLT_MAX);
+			brick.aabbMax = float3(-FLT_MAX);
+			for (uint32_t i = brick.firstTet; i < brick.firstTet + brick.tetCount; i++) {
+				for (uint32_t k = 0; k < 4; k++) {
+					const float3 v = vertices[indices[i][k]];
+					brick.aabbMin = min(brick.aabbMin, v);
+					brick.aabbMax = max(brick.aabbMax, v);
+				}
+			}
+		}
+	}, 16);
+	return bricks;
+}
+
+// True if no part of the box can be inside the view frustum (clip space x,y in [-w, w], z >= 0).
+inline bool OutsideFrustum(const float4x4& viewProjection, const float3 aabbMin, const float3 aabbMax) {
+	float4 corners[8];
+	for (uint32_t i = 0; i < 8; i++)
+		corners[i] = viewProjection * float4(i & 1 ? aabbMax.x : aabbMin.x, i & 2 ? aabbMax.y : aabbMin.y, i & 4 ? aabbMax.z : aabbMin.z, 1);
+	auto allOutside = [&](auto&& outside) { return std::ranges::all_of(corners, outside); };
+	return allOutside([](const float4 c) { return c.x < -c.w; }) ||
+	       allOutside([](const float4 c) { return c.x >  c.w; }) ||
+	       allOutside([](const float4 c) { return c.y < -c.w; }) ||
+	       allOutside([](const float4 c) { return c.y >  c.w; }) ||
+	       allOutside([](const float4 c) { return c.z < 0; });
+}
+
+inline float DistanceToBox(const float3 p, const float3 aabbMin, const float3 aabbMax) {
+	return length(max(max(aabbMin - p, p - aabbMax), float3(0)));
+}
+
+// Decides which bricks occupy the slots of the GPU pool.
+//
+// Every update ranks the bricks by distance to the camera, with bricks outside the frustum pushed
+// back by a fixed factor. Each brick is also ranked from where the camera will be after
+// kLookaheadFrames at its current velocity, and keeps the better of the two ranks, so bricks along
+// the direction of motion are streamed in before they come into view. The best slotCount bricks are
+// wanted. Missing ones replace the slots whose bricks have been unwanted the longest.
+class BrickResidency {
+public:
+	static constexpr uint32_t kNone = ~0u;
+	static constexpr float    kLookaheadFrames = 30;
+	static constexpr float    kOutsideFrustumPenalty = 4;
+
+	struct Load {
+		uint32_t brick;
+		uint32_t slot;
+	};
+	struct Plan {
+		std::vector<Load>     loads;    // bricks to copy into slots this frame, most important first
+		std::vector<uint32_t> prefetch; // wanted bricks that didn't fit in this frame's budget, to page in ahead of time
+	};
+
+private:
+	std::vector<uint32_t> mSlotBrick;  // brick held by each slot, or kNone
+	std::vector<uint32_t> mBrickSlot;  // slot holding each brick, or kNone
+	std::vector<uint64_t> mLastWanted; // per slot: update in which its brick was last wanted
+	uint64_t              mUpdate = 0;
+	float3                mLastEye  = float3(0);
+	float3                mVelocity = float3(0);
+	bool                  mHasEye   = false;
+
+public:
+	inline void Reset(const size_t brickCount, const size_t slotCount) {
+		mSlotBrick.assign(slotCount, kNone);
+		mBrickSlot.assign(brickCount, kNone);
+		mLastWanted.assign(slotCount, 0);
+		mUpdate = 0;
+		mHasEye = false;
+	}
+
+	inline size_t SlotCount() const { return mSlotBrick.size(); }
+	inline size_t ResidentCount() const { return std::ranges::count_if(mSlotBrick, [](const uint32_t b) { return b != kNone; }); }
+	inline uint32_t SlotOf(const uint32_t brick) const { return mBrickSlot[brick]; }
+
+	// Records that plan.loads[i] has been copied into its slot.
+	inline void Commit(const Load& load) {
+		if (const uint32_t old = mSlotBrick[load.slot]; old != kNone)
+			mBrickSlot[old] = kNone;
+		mSlotBrick[load.slot]  = load.brick;
+		mBrickSlot[load.brick] = load.slot;
+		mLastWanted[load.slot] = mUpdate;
+	}
+
+	// eye and viewProjection are in scene space. At most maxLoads bricks are scheduled.
+	inline Plan Update(const std::span<const Brick> bricks, const float4x4& viewProjection, const float3 eye, const size_t maxLoads) {
+		mUpdate++;
+		if (mHasEye)
+			mVelocity = 0.8f * mVelocity + 0.2f * (eye - mLastEye);
+		mLastEye = eye;
+		mHasEye  = true;
+		const float3 predicted = eye + mVelocity * kLookaheadFrames;
+
+		std::vector<float> score(bricks.size());
+		ParallelFor(bricks.size(), [&](size_t begin, size_t end) {
+			for (size_t b = begin; b < end; b++) {
+				const Brick& brick = bricks[b];
+				const float penalty = OutsideFrustum(viewProjection, brick.aabbMin, brick.aabbMax) ? kOutsideFrustumPenalty : 1.f;
+				const float now   = DistanceToBox(eye, brick.aabbMin, brick.aabbMax) * penalty;
+				const float ahead = DistanceToBox(predicted, brick.aabbMin, brick.aabbMax) * kOutsideFrustumPenalty;
+				score[b] = std::min(now, ahead);
+			}
+		}, 256);
+
+		const size_t wantedCount = std::min(SlotCount(), bricks.size());
+		std::vector<uint32_t> wanted(bricks.size());
+		std::iota(wanted.begin(), wanted.end(), 0u);
+		std::ranges::nth_element(wanted, wanted.begin() + wantedCount, {}, [&](const uint32_t b) { return score[b]; });
+		wanted.resize(wantedCount);
+		std::ranges::sort(wanted, {}, [&](const uint32_t b) { return score[b]; });
+
+		std::vector<uint8_t> isWanted(bricks.size(), 0);
+		for (const uint32_t b : wanted) {
+			isWanted[b] = 1;
+			if (mBrickSlot[b] != kNone)
+				mLastWanted[mBrickSlot[b]] = mUpdate;
+		}
+
+		// free slots first, then the ones unwanted for the longest
+		std::vector<uint32_t> victims;
+		for (uint32_t s = 0; s < SlotCount(); s++)
+			if (mSlotBrick[s] == kNone || !isWanted[mSlotBrick[s]])
+				victims.push_back(s);
+		std::ranges::sort(victims, {}, [&](const uint32_t s) { return mSlotBrick[s] == kNone ? 0 : mLastWanted[s] + 1; });
+
+		Plan plan;
+		size_t v = 0;
+		for (const uint32_t b : wanted) {
+			if (mBrickSlot[b] != kNone)
+				continue;
+			if (plan.loads.size() < maxLoads && v < victims.size())
+				plan.loads.emplace_back(b, victims[v++]);
+			else
+				plan.prefetch.push_back(b);
+		}
+		return plan;
+	}
+};
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <Rose/Core/RoseEngine.h>
+
+#include "Parallel.hpp"
+
+namespace vkDelTet {
+
+using namespace RoseEngine;
+
+// Compressed sparse row table: row i holds values[offsets[i] .. offsets[i+1]).
+struct CsrTable {
+	std::vector<uint32_t> offsets; // size() + 1 entries
+	std::vector<uint32_t> values;
+
+	inline size_t size()  const { return offsets.empty() ? 0 : offsets.size() - 1; }
+	inline bool   empty() const { return size() == 0; }
+	inline size_t size_bytes() const { return (offsets.size() + values.size()) * sizeof(uint32_t); }
+
+	inline std::span<const uint32_t> operator[](const size_t i) const {
+		return std::span(values).subspan(offsets[i], offsets[i + 1] - offsets[i]);
+	}
+};
+
+// Tets incident to each vertex, in ascending tet order.
+// Built with a parallel count / prefix sum / scatter, then each row is sorted so the
+// result doesn't depend on thread scheduling.
+inline CsrTable BuildVertexToTets(const std::span<const uint4> indices, const uint32_t numVertices) {
+	CsrTable table;
+	std::vector<uint32_t> counts(numVertices, 0);
+	ParallelFor(indices.size(), [&](size_t begin, size_t end) {
+		for (size_t tetId = begin; tetId < end; tetId++)
+			for (uint32_t k = 0; k < 4; k++)
+				std::atomic_ref(counts[indices[tetId][k]]).fetch_add(1, std::memory_order_relaxed);
+	});
+	ParallelExclusiveScan(counts, table.offsets);
+
+	table.values.resize(table.offsets[numVertices]);
+	std::vector<uint32_t>& cursor = counts;
+	std::copy(table.offsets.begin(), table.offsets.end() - 1, cursor.begin());
+	ParallelFor(indices.size(), [&](size_t begin, size_t end) {
+		for (size_t tetId = begin; tetId < end; tetId++)
+			for (uint32_t k = 0; k < 4; k++)
+				table.values[std::atomic_ref(cursor[indices[tetId][k]]).fetch_add(1, std::memory_order_relaxed)] = (uint32_t)tetId;
+	});
+	ParallelFor(numVertices, [&](size_t begin, size_t end) {
+		for (size_t v = begin; v < end; v++)
+			std::sort(table.values.begin() + table.offsets[v], table.values.begin() + table.offsets[v + 1]);
+	});
+	return table;
+}
+
+// Unique, sorted neighbours of each vertex through any shared tet.
+// Two parallel passes over the vertices: one to size each row, one to fill it.
+inline CsrTable BuildVertexAdjacency(const CsrTable& vertexToTets, const std::span<const uint4> indices) {
+	const size_t numVertices = vertexToTets.size();
+	auto gatherNeighbours = [&](const uint32_t v, std::vector<uint32_t>& scratch) {
+		scratch.clear();
+		for (const uint32_t tetId : vertexToTets[v])
+			for (uint32_t k = 0; k < 4; k++)
+				if (indices[tetId][k] != v)
+					scratch.push_back(indices[tetId][k]);
+		std::ranges::sort(scratch);
+		scratch.erase(std::unique(scratch.begin(), scratch.end()), scratch.end());
+	};
+
+	CsrTable table;
+	std::vector<uint32_t> counts(numVertices);
+	ParallelFor(numVertices, [&](size_t begin, size_t end) {
+		std::vector<uint32_t> scratch;
+		for (size_t v = begin; v < end; v++) {
+			gatherNeighbours((uint32_t)v, scratch);
+			counts[v] = (uint32_t)scratch.size();
+		}
+	});
+	ParallelExclusiveScan(counts, table.offsets);
+
+	table.values.resize(table.offsets[numVertices]);
+	ParallelFor(numVertices, [&](size_t begin, size_t end) {
+		std::vector<uint32_t> scratch;
+		for (size_t v = begin; v < end; v++) {
+			gatherNeighbours((uint32_t)v, scratch);
+			std::ranges::copy(scratch, table.values.begin() + table.offsets[v]);
+		}
+	});
+	return table;
+}
+
+}
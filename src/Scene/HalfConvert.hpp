@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VKDELTET_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace vkDelTet {
+
+// fp32 -> fp16 with round-to-nearest-even, overflow to infinity, gradual underflow
+// and quiet NaNs: the same result f32tof16 produces in the shaders.
+inline uint16_t FloatToHalf(const float f) {
+	uint32_t x;
+	std::memcpy(&x, &f, sizeof(x));
+	const uint32_t sign = (x >> 16) & 0x8000;
+	const uint32_t absx = x & 0x7fffffff;
+
+	if (absx >= 0x7f800000) // inf or nan
+		return (uint16_t)(sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 | ((absx >> 13) & 0x3ff) : 0));
+	if (absx >= 0x477ff000) // rounds to a value above the largest half
+		return (uint16_t)(sign | 0x7c00);
+	if (absx < 0x38800000) { // half denormal or zero
+		if (absx < 0x33000000)
+			return (uint16_t)sign;
+		const uint32_t shift = 126 - (absx >> 23);
+		const uint32_t mant  = (absx & 0x7fffff) | 0x800000;
+		const uint32_t half  = mant >> shift;
+		const uint32_t rem   = mant & ((1u << shift) - 1);
+		const uint32_t mid   = 1u << (shift - 1);
+		return (uint16_t)(sign | (half + (rem > mid || (rem == mid && (half & 1)))));
+	}
+	const uint32_t rounded = absx + 0xfff + ((absx >> 13) & 1) - 0x38000000;
+	return (uint16_t)(sign | (rounded >> 13));
+}
+
+inline float HalfToFloat(const uint16_t h) {
+	const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	const uint32_t exp  = (h >> 10) & 0x1f;
+	uint32_t       mant = h & 0x3ff;
+	uint32_t x;
+	if (exp == 0x1f)
+		x = sign | 0x7f800000 | (mant << 13) | (mant ? 0x400000 : 0); // nans come back quiet
+	else if (exp != 0)
+		x = sign | ((exp + 112) << 23) | (mant << 13);
+	else if (mant == 0)
+		x = sign;
+	else {
+		// renormalize a half denormal
+		uint32_t e = 113;
+		while (!(mant & 0x400)) { mant <<= 1; e--; }
+		x = sign | (e << 23) | ((mant & 0x3ff) << 13);
+	}
+	float f;
+	std::memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+#ifdef VKDELTET_X86
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx,f16c")))
+#endif
+inline void FloatToHalfF16C(const float* src, uint16_t* dst, const size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+	for (; i < n; i++)
+		dst[i] = FloatToHalf(src[i]);
+}
+
+inline bool CpuHasF16C() {
+#if defined(__GNUC__) || defined(__clang__)
+	static const bool supported = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+#else
+	static const bool supported = []() {
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 28)) && (info[2] & (1 << 29)); // avx, f16c
+	}();
+#endif
+	return supported;
+}
+#endif
+
+// Converts n floats to halves, using F16C when the CPU has it.
+inline void FloatToHalf(const float* src, uint16_t* dst, const size_t n) {
+#ifdef VKDELTET_X86
+	if (CpuHasF16C()) {
+		FloatToHalfF16C(src, dst, n);
+		return;
+	}
+#endif
+	for (size_t i = 0; i < n; i++)
+		dst[i] = FloatToHalf(src[i]);
+}
+
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <functional>
+#include <iostream>
+
+#include <Rose/Core/CommandContext.hpp>
+
+#include "PlyScene.hpp"
+#include "PrecisionPolicy.hpp"
+#include "SHCodebook.hpp"
+#include "TetClusters.hpp"
+
+namespace vkDelTet {
+
+using namespace RoseEngine;
+
+// Picks the storage formats of a scene so that it fits in the device memory that is left.
+//
+// The footprint is estimated from the counts in the file header, before anything is read or
+// allocated: the scene buffers in the candidate formats, plus the per-tet scratch RenderContext
+// allocates to cull, sort and shade. Starting from the preferred formats, cheaper formats are
+// tried one step at a time, roughly in order of visual impact, until the estimate fits.
+
+struct LoadPlan {
+	PrecisionPolicy precision;
+	size_t          sceneBytes   = 0;
+	size_t          scratchBytes = 0;
+	size_t          budgetBytes  = 0; // device-local memory available when planning; 0 if unknown
+	bool            fits         = true;
+
+	inline void Print(std::ostream& os) const {
+		os << "Load plan: " << (sceneBytes >> 20) << " MiB scene + " << (scratchBytes >> 20) << " MiB render scratch";
+		if (budgetBytes > 0)
+			os << " of " << (budgetBytes >> 20) << " MiB available";
+		os << " (vertices " << VertexFormatName(precision.vertices)
+		   << ", densities " << PrecisionName(precision.densities)
+		   << ", gradients " << PrecisionName(precision.gradients)
+		   << ", SH " << SHFormatName(precision.sh)
+		   << ", colors " << ColorFormatName(precision.colors) << ")";
+		if (!fits)
+			os << ", does not fit";
+		os << std::endl;
+	}
+};
+
+// GPU bytes of the scene buffers of TetrahedronScene in the given formats, plus the interleaved
+// tet records if those are packed (TetRecordSize).
+inline size_t SceneFootprint(const size_t vertexCount, const size_t tetCount, const uint32_t numSHCoeffs, const PrecisionPolicy& p, const size_t tetRecordSize = 0) {
+	size_t bytes = vertexCount * p.VertexSize() + tetCount * tetRecordSize;
+	bytes += tetCount * (sizeof(uint4) + sizeof(float4) + sizeof(float3) + sizeof(float)); // indices, spheres, centroids, offsets
+	bytes += tetCount * (p.DensitySize() + p.GradientSize());
+	bytes += ClusterCount((uint32_t)tetCount) * sizeof(TetCluster);
+	for (uint32_t first = 0, i = 0; first < numSHCoeffs; first += COEFFS_PER_BUF, i++) {
+		const uint32_t coeffsInBuf = std::min<uint32_t>(COEFFS_PER_BUF, numSHCoeffs - first);
+		switch (p.sh) {
+			case SHFormat::eFloat32:  bytes += tetCount * coeffsInBuf * sizeof(float3); break;
+			case SHFormat::eFloat16:  bytes += tetCount * coeffsInBuf * 3 * sizeof(uint16_t); break;
+			case SHFormat::eUNorm8:   bytes += SHQuantizedSize(tetCount, COEFFS_PER_BUF); break;
+			case SHFormat::eCodebook: bytes += SHCodebookSize(tetCount, COEFFS_PER_BUF, i == 0); break;
+		}
+	}
+	return bytes;
+}
+
+// GPU bytes RenderContext::PrepareScene allocates per tet: evaluatedColors, sortKeys, sortBuffer,
+// sortPayloads and markedTets.
+inline size_t RenderScratchFootprint(const size_t tetCount, const PrecisionPolicy& p) {
+	return tetCount * (p.ColorSize() + sizeof(uint) + sizeof(uint2) + sizeof(uint) + sizeof(uint));
+}
+
+// Device-local memory that can still be allocated without exceeding the heap budgets. While a scene
+// is being replaced, the old one is still resident, so the estimate is conservative.
+inline size_t DeviceMemoryBudget(const Device& device) {
+	const VkPhysicalDeviceMemoryProperties* properties = nullptr;
+	vmaGetMemoryProperties(device.MemoryAllocator(), &properties);
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetHeapBudgets(device.MemoryAllocator(), budgets);
+	size_t available = 0;
+	for (uint32_t i = 0; i < properties->memoryHeapCount; i++)
+		if ((properties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && budgets[i].budget > budgets[i].usage)
+			available = std::max<size_t>(available, budgets[i].budget - budgets[i].usage);
+	return available;
+}
+
+// shFixed: the SH format can't be changed (packed scenes that were baked with quantized SH).
+inline LoadPlan PlanLoad(const size_t vertexCount, const size_t tetCount, const uint32_t numSHCoeffs, const PrecisionPolicy& preferred, const size_t budgetBytes, const bool shFixed = false, const size_t tetRecordSize = 0) {
+	LoadPlan plan;
+	plan.precision   = preferred;
+	plan.budgetBytes = budgetBytes;
+	auto fits = [&]() {
+		plan.sceneBytes   = SceneFootprint(vertexCount, tetCount, numSHCoeffs, plan.precision, tetRecordSize);
+		plan.scratchBytes = RenderScratchFootprint(tetCount, plan.precision);
+		return budgetBytes == 0 || plan.sceneBytes + plan.scratchBytes <= budgetBytes;
+	};
+	// each step only ever shrinks the footprint, and keeps the previous ones; the SH and color formats
+	// are ordered from largest to smallest, so a step never replaces a preferred format that is smaller
+	auto shStep = [&](const SHFormat f) {
+		if (!shFixed && (uint32_t)plan.precision.sh < (uint32_t)f)
+			plan.precision.sh = f;
+	};
+	auto colorStep = [&](const ColorFormat f) {
+		if ((uint32_t)plan.precision.colors < (uint32_t)f)
+			plan.precision.colors = f;
+	};
+	const std::function<void()> steps[] = {
+		[&]{ plan.precision.densities = Precision::eFloat16; },
+		[&]{ colorStep(ColorFormat::eFloat16); },
+		[&]{ plan.precision.gradients = Precision::eFloat16; },
+		[&]{ shStep(SHFormat::eFloat16); },
+		[&]{ colorStep(ColorFormat::eSharedExp); },
+		[&]{ plan.precision.vertices = VertexFormat::eUNorm21; },
+		[&]{ shStep(SHFormat::eUNorm8); },
+		[&]{ shStep(SHFormat::eCodebook); } };
+	plan.fits = fits();
+	for (size_t i = 0; i < std::size(steps) && !plan.fits; i++) {
+		steps[i]();
+		plan.fits = fits();
+	}
+	return plan;
+}
+
+}
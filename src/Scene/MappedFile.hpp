@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vkDelTet {
+
+// RAII memory mapping of an entire file, read-only unless opened writable.
+// Pages are faulted in by the OS on first access, so mapping a multi-GB
+// checkpoint costs no heap memory and the page cache can be reclaimed freely.
+// Writable mappings are shared: stores go to the file, and Flush() makes them durable.
+class MappedFile {
+private:
+	std::byte* mData = nullptr;
+	size_t     mSize = 0;
+	bool       mWritable = false;
+#ifdef _WIN32
+	HANDLE mFile    = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = nullptr;
+#endif
+
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	inline MappedFile(MappedFile&& rhs) noexcept { Swap(rhs); }
+	inline MappedFile& operator=(MappedFile&& rhs) noexcept { Swap(rhs); return *this; }
+	inline ~MappedFile() { Close(); }
+
+	inline void Swap(MappedFile& rhs) noexcept {
+		std::swap(mData, rhs.mData);
+		std::swap(mSize, rhs.mSize);
+		std::swap(mWritable, rhs.mWritable);
+#ifdef _WIN32
+		std::swap(mFile, rhs.mFile);
+		std::swap(mMapping, rhs.mMapping);
+#endif
+	}
+
+	inline bool Open(const std::filesystem::path& p, const bool writable = false) {
+		Close();
+#ifdef _WIN32
+		mFile = CreateFileW(p.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | (writable ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN), nullptr);
+		if (mFile == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0) {
+			Close();
+			return false;
+		}
+		mMapping = CreateFileMappingW(mFile, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+		if (!mMapping) {
+			Close();
+			return false;
+		}
+		mData = static_cast<std::byte*>(MapViewOfFile(mMapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+		if (!mData) {
+			Close();
+			return false;
+		}
+		mSize = (size_t)size.QuadPart;
+#else
+		const int fd = ::open(p.c_str(), writable ? O_RDWR : O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+		void* ptr = writable ?
+			mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) :
+			mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // the mapping keeps its own reference to the file
+		if (ptr == MAP_FAILED)
+			return false;
+		mData = static_cast<std::byte*>(ptr);
+		mSize = (size_t)st.st_size;
+#endif
+		mWritable = writable;
+		return true;
+	}
+
+	inline void Close() {
+#ifdef _WIN32
+		if (mData)                        UnmapViewOfFile(mData);
+		if (mMapping)                     CloseHandle(mMapping);
+		if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+		mMapping = nullptr;
+		mFile    = INVALID_HANDLE_VALUE;
+#else
+		if (mData) munmap(mData, mSize);
+#endif
+		mData = nullptr;
+		mSize = 0;
+		mWritable = false;
+	}
+
+	// Writes dirty pages of a writable mapping back to the file and waits for the device.
+	inline bool Flush() const {
+		if (!mData || !mWritable)
+			return false;
+#ifdef _WIN32
+		return FlushViewOfFile(mData, 0) && FlushFileBuffers(mFile);
+#else
+		return msync(mData, mSize, MS_SYNC) == 0;
+#endif
+	}
+
+	// Hint that the mapping will be streamed front to back, so the OS reads ahead aggressively.
+	inline void AdviseSequential() const {
+#ifndef _WIN32
+		if (mData) madvise(mData, mSize, MADV_SEQUENTIAL);
+#endif
+	}
+
+	// Starts reading [p, p + n) into the page cache in the background.
+	inline void AdviseWillNeed(const std::byte* p, const size_t n) const {
+#ifndef _WIN32
+		const uintptr_t page  = (uintptr_t)sysconf(_SC_PAGESIZE);
+		const uintptr_t first = (uintptr_t)p & ~(page - 1);
+		madvise((void*)first, (uintptr_t)p + n - first, MADV_WILLNEED);
+#else
+		WIN32_MEMORY_RANGE_ENTRY range{ (void*)p, n };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+	}
+
+	inline std::span<const std::byte> Bytes() const { return { mData, mSize }; }
+	inline const std::byte* data() const { return mData; }
+	inline std::byte* writable_data() const { return mWritable ? mData : nullptr; }
+	inline size_t size() const { return mSize; }
+	inline explicit operator bool() const { return mData != nullptr; }
+};
+
+}
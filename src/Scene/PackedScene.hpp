@@ -0,0 +1,380 @@
+#pragma once
+
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+#include "BrickStreaming.hpp"
+#include "Csr.hpp"
+#include "HalfConvert.hpp"
+#include "MappedFile.hpp"
+#include "PlyScene.hpp"
+#include "SHCodebook.hpp"
+#include "SHQuantize.hpp"
+#include "SpatialSort.hpp"
+#include "TetGeometry.hpp"
+
+namespace vkDelTet {
+
+// .rmsh: a versioned container holding a scene in exactly the layout the GPU buffers use,
+// together with everything Load would otherwise derive at startup. Loading one is a
+// file mapping plus one verbatim upload per section.
+//
+//   [PackedSceneHeader][PackedSectionEntry x sectionCount][section]...[section]
+//
+// Every section starts on a kPackedSectionAlignment boundary, so typed views into the
+// mapping are properly aligned.
+
+static constexpr uint32_t kPackedSceneMagic       = 0x48534d52; // "RMSH"
+static constexpr uint32_t kPackedSceneVersion     = 2;
+static constexpr size_t   kPackedSectionAlignment = 256;
+
+enum class PackedSectionType : uint32_t {
+	eVertices,          // float3 per vertex
+	eIndices,           // uint4 per tet
+	eDensities,         // float per tet
+	eGradients,         // float3 per tet
+	eSH,                // one section per SH buffer (index = buffer id), in the header's shFormat
+	eCircumspheres,     // float4 per tet
+	eCentroids,         // float3 per tet
+	eOffsets,           // float per tet
+	eAdjacencyOffsets,  // CSR vertex adjacency
+	eAdjacency,
+	eVertexTetOffsets,  // CSR vertex to tet table
+	eVertexTets,
+	eVertexOrder,       // uint per vertex: id in the source checkpoint (optional)
+	eTetOrder,          // uint per tet: id in the source checkpoint (optional)
+	eBricks,            // Brick per kBrickTets tets, for out-of-core streaming (optional)
+};
+
+struct PackedSectionEntry {
+	PackedSectionType type;
+	uint32_t          index;
+	uint64_t          offset;
+	uint64_t          size;
+};
+
+struct PackedSceneHeader {
+	uint32_t magic        = kPackedSceneMagic;
+	uint32_t version      = kPackedSceneVersion;
+	uint32_t vertexCount  = 0;
+	uint32_t tetCount     = 0;
+	uint32_t numSHCoeffs  = 0;
+	uint32_t coeffsPerBuf = COEFFS_PER_BUF;
+	uint32_t sectionCount = 0;
+	uint32_t shFormat     = (uint32_t)SHFormat::eFloat16;
+	float3   aabbMin      = float3(0);
+	float    maxDensity   = 0;
+	float3   aabbMax      = float3(0);
+	float    reserved2    = 0;
+};
+
+class PackedSceneFile {
+private:
+	MappedFile                          mFile;
+	PackedSceneHeader                   mHeader;
+	std::span<const PackedSectionEntry> mSections;
+
+public:
+	// sequential: hint the OS to read ahead, for loads that stream every section front to back
+	inline bool Open(const std::filesystem::path& p, const bool sequential = true) {
+		if (!mFile.Open(p)) {
+			std::cerr << "Failed to map " << p << std::endl;
+			return false;
+		}
+		if (mFile.size() < sizeof(PackedSceneHeader)) {
+			std::cerr << p << " is not a packed scene." << std::endl;
+			return false;
+		}
+		std::memcpy(&mHeader, mFile.data(), sizeof(PackedSceneHeader));
+		if (mHeader.magic != kPackedSceneMagic) {
+			std::cerr << p << " is not a packed scene." << std::endl;
+			return false;
+		}
+		if (mHeader.version == 1)
+			mHeader.shFormat = (uint32_t)SHFormat::eFloat16; // version 1 always stored fp16 SH
+		if (mHeader.version > kPackedSceneVersion || mHeader.coeffsPerBuf != COEFFS_PER_BUF || mHeader.shFormat > (uint32_t)SHFormat::eCodebook) {
+			std::cerr << p << " was written by an incompatible version (" << mHeader.version << "), re-bake it." << std::endl;
+			return false;
+		}
+		const size_t tableEnd = sizeof(PackedSceneHeader) + mHeader.sectionCount * sizeof(PackedSectionEntry);
+		if (tableEnd > mFile.size()) {
+			std::cerr << p << " is truncated." << std::endl;
+			return false;
+		}
+		mSections = { reinterpret_cast<const PackedSectionEntry*>(mFile.data() + sizeof(PackedSceneHeader)), mHeader.sectionCount };
+		for (const PackedSectionEntry& s : mSections) {
+			if (s.offset % kPackedSectionAlignment != 0 || s.offset + s.size > mFile.size()) {
+				std::cerr << p << " is truncated." << std::endl;
+				return false;
+			}
+		}
+		if (sequential)
+			mFile.AdviseSequential();
+		return true;
+	}
+
+	inline const PackedSceneHeader& Header() const { return mHeader; }
+	inline const MappedFile& File() const { return mFile; }
+
+	inline bool HasSection(const PackedSectionType type, const uint32_t index = 0) const {
+		return std::ranges::any_of(mSections, [&](const auto& s) { return s.type == type && s.index == index; });
+	}
+
+	// Typed view of a section, or an empty span if the file doesn't contain it.
+	template<typename T>
+	inline std::span<const T> Section(const PackedSectionType type, const uint32_t index = 0) const {
+		for (const PackedSectionEntry& s : mSections)
+			if (s.type == type && s.index == index)
+				return { reinterpret_cast<const T*>(mFile.data() + s.offset), s.size / sizeof(T) };
+		return {};
+	}
+};
+
+class PackedSceneWriter {
+private:
+	struct PendingSection {
+		PackedSectionType          type;
+		uint32_t                   index;
+		std::span<const std::byte> data;
+	};
+	std::vector<PendingSection> mSections;
+
+	inline static size_t Align(const size_t x) { return (x + kPackedSectionAlignment - 1) / kPackedSectionAlignment * kPackedSectionAlignment; }
+
+public:
+	// The data must stay alive until Write() returns.
+	template<typename T>
+	inline void Add(const PackedSectionType type, const uint32_t index, const std::span<const T> data) {
+		mSections.emplace_back(type, index, std::as_bytes(data));
+	}
+	template<typename T>
+	inline void Add(const PackedSectionType type, const std::vector<T>& data) { Add(type, 0, std::span<const T>(data)); }
+
+	// Writes to a temporary file next to p and renames it into place, so an
+	// interrupted write never leaves a truncated scene behind.
+	inline bool Write(const std::filesystem::path& p, PackedSceneHeader header) const {
+		header.sectionCount = (uint32_t)mSections.size();
+
+		std::vector<PackedSectionEntry> table;
+		size_t offset = Align(sizeof(PackedSceneHeader) + mSections.size() * sizeof(PackedSectionEntry));
+		for (const PendingSection& s : mSections) {
+			table.emplace_back(s.type, s.index, (uint64_t)offset, (uint64_t)s.data.size());
+			offset = Align(offset + s.data.size());
+		}
+
+		const std::filesystem::path tmp = std::filesystem::path(p).concat(".tmp");
+		{
+			std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+			if (!file) {
+				std::cerr << "Failed to open " << tmp << " for writing." << std::endl;
+				return false;
+			}
+			static const char zeros[kPackedSectionAlignment] = {};
+			auto pad = [&]() {
+				const size_t pos = (size_t)file.tellp();
+				file.write(zeros, Align(pos) - pos);
+			};
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(PackedSectionEntry));
+			for (const PendingSection& s : mSections) {
+				pad();
+				file.write(reinterpret_cast<const char*>(s.data.data()), s.data.size());
+			}
+			pad();
+			if (!file) {
+				std::cerr << "Failed to write " << tmp << std::endl;
+				return false;
+			}
+		}
+		std::error_code ec;
+		std::filesystem::rename(tmp, p, ec);
+		if (ec) {
+			std::cerr << "Failed to rename " << tmp << ": " << ec.message() << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
+
+struct BakeOptions {
+	bool     dropDegenerate = true; // drop tets no renderer would draw (ValidateTets)
+	bool     spatialReorder = true;
+	SHFormat shFormat       = SHFormat::eFloat16;
+};
+
+// Derives everything Load computes at startup (spatial order, SH encoding, circumspheres,
+// centroids, offsets, CSR adjacency) on the CPU and writes it as a packed scene.
+// Every stage runs in parallel on the shared thread pool and reports its time.
+inline bool BakePackedScene(const PlySceneViews& views, const std::filesystem::path& dst, const BakeOptions& options = {}) {
+	const auto start = std::chrono::high_resolution_clock::now();
+	auto stage = [](const char* name, auto&& fn) {
+		const auto t0 = std::chrono::high_resolution_clock::now();
+		fn();
+		const auto t1 = std::chrono::high_resolution_clock::now();
+		std::cout << "  " << name << ": " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << "ms" << std::endl;
+	};
+
+	std::vector<float3> vertices;
+	std::vector<uint4>  indices;
+	std::vector<float>  densities;
+	std::vector<float3> gradients;
+	PackedSceneHeader header;
+	stage("read", [&]() {
+		views.positions.CopyTo(vertices);
+		views.indices.CopyTo(indices);
+		header.aabbMin = float3( FLT_MAX);
+		header.aabbMax = float3(-FLT_MAX);
+		for (const float3 v : vertices) {
+			header.aabbMin = min(header.aabbMin, v);
+			header.aabbMax = max(header.aabbMax, v);
+		}
+	});
+
+	// tetOrder maps baked tet ids to source tet ids; both orders stay empty while they are the identity
+	std::vector<uint32_t> tetOrder, vertexOrder;
+	if (options.dropDegenerate) {
+		stage("filter", [&]() {
+			std::vector<float> fileDensities;
+			views.densities.CopyTo(fileDensities);
+			TetValidationReport report = ValidateTets(vertices, indices, fileDensities);
+			if (report.invalid() == 0)
+				return;
+			std::cout << "  ";
+			report.Print(std::cout);
+			CompactTets(indices, report.valid);
+			tetOrder = std::move(report.valid);
+		});
+	}
+	if (options.spatialReorder) {
+		stage("reorder", [&]() {
+			SpatialReorder reorder = ReorderScene(vertices, indices, header.aabbMin, header.aabbMax);
+			if (!tetOrder.empty())
+				ComposeOrder(reorder.tetOrder, tetOrder);
+			tetOrder    = std::move(reorder.tetOrder);
+			vertexOrder = std::move(reorder.vertexOrder);
+		});
+	}
+	if (!tetOrder.empty() && vertexOrder.empty()) {
+		vertexOrder.resize(vertices.size());
+		std::iota(vertexOrder.begin(), vertexOrder.end(), 0u);
+	}
+	const size_t numTets = indices.size();
+	const uint32_t* order = tetOrder.empty() ? nullptr : tetOrder.data();
+
+	header.vertexCount = (uint32_t)vertices.size();
+	header.tetCount    = (uint32_t)numTets;
+	header.numSHCoeffs = views.numSHCoeffs;
+	header.shFormat    = (uint32_t)options.shFormat;
+
+	// every per-tet attribute is gathered in the baked tet order
+	stage("gather", [&]() {
+		densities.resize(numTets);
+		gradients.resize(numTets);
+		ParallelFor(numTets, [&](size_t begin, size_t end) {
+			if (order) {
+				views.densities.Gather(densities.data() + begin, order, begin, end - begin);
+				views.gradients.Gather(gradients.data() + begin, order, begin, end - begin);
+			} else {
+				views.densities.Gather(densities.data() + begin, begin, end - begin);
+				views.gradients.Gather(gradients.data() + begin, begin, end - begin);
+			}
+		});
+		for (const float d : densities)
+			header.maxDensity = max(header.maxDensity, d);
+	});
+
+	std::vector<std::vector<std::byte>> sh(views.sh.size());
+	stage("sh", [&]() {
+		for (uint32_t i = 0; i < views.sh.size(); i++) {
+			const StridedView& src = views.sh[i];
+			const uint32_t coeffsInBuf = (uint32_t)(src.recordSize / sizeof(float3));
+			auto fetch = [&](size_t tetId, float* rgb) { src.Gather(rgb, order ? order[tetId] : tetId, 1); };
+			switch (options.shFormat) {
+				case SHFormat::eFloat32:
+				case SHFormat::eFloat16: {
+					const size_t scalarSize = options.shFormat == SHFormat::eFloat32 ? sizeof(float) : sizeof(uint16_t);
+					sh[i].resize(numTets * coeffsInBuf * 3 * scalarSize);
+					ParallelFor(numTets, [&](size_t begin, size_t end) {
+						std::vector<float> coeffs((end - begin) * coeffsInBuf * 3);
+						if (order)
+							src.Gather(coeffs.data(), order, begin, end - begin);
+						else
+							src.Gather(coeffs.data(), begin, end - begin);
+						std::byte* out = sh[i].data() + begin * coeffsInBuf * 3 * scalarSize;
+						if (options.shFormat == SHFormat::eFloat32)
+							std::memcpy(out, coeffs.data(), coeffs.size() * sizeof(float));
+						else
+							FloatToHalf(coeffs.data(), reinterpret_cast<uint16_t*>(out), coeffs.size());
+					}, 1024);
+					break;
+				}
+				case SHFormat::eUNorm8:
+					sh[i] = QuantizeSH(numTets, coeffsInBuf, COEFFS_PER_BUF, fetch);
+					break;
+				case SHFormat::eCodebook:
+					sh[i] = BuildSHCodebook(numTets, coeffsInBuf, COEFFS_PER_BUF, i == 0, fetch);
+					break;
+			}
+		}
+	});
+
+	std::vector<float4> circumspheres(numTets);
+	std::vector<float3> centroids(numTets);
+	std::vector<float>  offsets(numTets);
+	stage("spheres", [&]() {
+		ParallelFor(numTets, [&](size_t begin, size_t end) {
+			ComputeTetSpheres(vertices, indices, gradients, circumspheres, centroids, offsets, begin, end - begin);
+		});
+	});
+
+	CsrTable vertexToTets, adjacency;
+	stage("adjacency", [&]() {
+		vertexToTets = BuildVertexToTets(indices, header.vertexCount);
+		adjacency    = BuildVertexAdjacency(vertexToTets, indices);
+	});
+
+	std::vector<Brick> bricks;
+	stage("bricks", [&]() { bricks = BuildBricks(vertices, indices); });
+
+	PackedSceneWriter writer;
+	writer.Add(PackedSectionType::eVertices,  vertices);
+	writer.Add(PackedSectionType::eIndices,   indices);
+	writer.Add(PackedSectionType::eDensities, densities);
+	writer.Add(PackedSectionType::eGradients, gradients);
+	for (uint32_t i = 0; i < sh.size(); i++)
+		writer.Add(PackedSectionType::eSH, i, std::span<const std::byte>(sh[i]));
+	writer.Add(PackedSectionType::eCircumspheres,    circumspheres);
+	writer.Add(PackedSectionType::eCentroids,        centroids);
+	writer.Add(PackedSectionType::eOffsets,          offsets);
+	writer.Add(PackedSectionType::eAdjacencyOffsets, adjacency.offsets);
+	writer.Add(PackedSectionType::eAdjacency,        adjacency.values);
+	writer.Add(PackedSectionType::eVertexTetOffsets, vertexToTets.offsets);
+	writer.Add(PackedSectionType::eVertexTets,       vertexToTets.values);
+	writer.Add(PackedSectionType::eBricks,           bricks);
+	if (!tetOrder.empty()) {
+		writer.Add(PackedSectionType::eVertexOrder, vertexOrder);
+		writer.Add(PackedSectionType::eTetOrder,    tetOrder);
+	}
+	bool ok = false;
+	stage("write", [&]() { ok = writer.Write(dst, header); });
+	if (!ok)
+		return false;
+
+	const auto end = std::chrono::high_resolution_clock::now();
+	std::cout << "Baked " << dst << " (" << numTets << " tets, " << SHFormatName(options.shFormat) << " SH) in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+	return true;
+}
+
+inline bool BakePackedScene(const std::filesystem::path& src, const std::filesystem::path& dst, const BakeOptions& options = {}) {
+	PlySceneSource source;
+	if (!source.Open(src))
+		return false;
+	return BakePackedScene(source.views, dst, options);
+}
+
+}
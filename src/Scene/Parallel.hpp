@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vkDelTet {
+
+inline size_t WorkerCount() {
+	return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+// Persistent workers shared by every ParallelFor, so short parallel loops don't pay for
+// thread creation. A job is a number of tasks that the workers and the submitting thread
+// claim through an atomic counter. The submitting thread keeps claiming tasks until the
+// job is exhausted before it waits, so a ParallelFor nested inside a task always makes
+// progress, even when every worker is busy.
+class ThreadPool {
+private:
+	struct Job {
+		std::function<void(size_t)> task;
+		size_t                      count;
+		std::atomic<size_t>         next = 0;
+		std::atomic<size_t>         done = 0;
+	};
+
+	std::mutex                       mMutex;
+	std::condition_variable          mCv;
+	std::deque<std::shared_ptr<Job>> mJobs;
+	bool                             mStop = false;
+	std::vector<std::jthread>        mThreads;
+
+	inline static void Work(Job& job) {
+		for (size_t i = job.next++; i < job.count; i = job.next++) {
+			job.task(i);
+			if (++job.done == job.count)
+				job.done.notify_all();
+		}
+	}
+
+	inline void WorkerLoop() {
+		while (true) {
+			std::shared_ptr<Job> job;
+			{
+				std::unique_lock lock(mMutex);
+				mCv.wait(lock, [&]{ return mStop || !mJobs.empty(); });
+				if (mStop)
+					return;
+				job = mJobs.front();
+				if (job->next >= job->count) {
+					mJobs.pop_front(); // every task is claimed; whoever claimed them finishes them
+					continue;
+				}
+			}
+			Work(*job);
+		}
+	}
+
+public:
+	inline explicit ThreadPool(const size_t threadCount) {
+		for (size_t i = 0; i < threadCount; i++)
+			mThreads.emplace_back([this]() { WorkerLoop(); });
+	}
+	inline ~ThreadPool() {
+		{
+			std::lock_guard lock(mMutex);
+			mStop = true;
+		}
+		mCv.notify_all();
+	}
+
+	// One worker per hardware thread besides the caller
+	inline static ThreadPool& Get() {
+		static ThreadPool pool(WorkerCount() - 1);
+		return pool;
+	}
+
+	// Calls task(i) for every i in [0, count) and returns once all of them have returned.
+	inline void Run(const size_t count, std::function<void(size_t)> task) {
+		auto job = std::make_shared<Job>();
+		job->task  = std::move(task);
+		job->count = count;
+		{
+			std::lock_guard lock(mMutex);
+			mJobs.push_back(job);
+		}
+		mCv.notify_all();
+
+		Work(*job);
+		for (size_t done = job->done; done < count; done = job->done)
+			job->done.wait(done);
+
+		std::lock_guard lock(mMutex);
+		std::erase(mJobs, job);
+	}
+};
+
+// Splits [0, n) into one contiguous range per worker and calls fn(begin, end) for each,
+// blocking until all of them return. Small ranges run inline on the calling thread.
+template<typename Fn>
+inline void ParallelFor(const size_t n, Fn&& fn, const size_t minPerWorker = 4096) {
+	const size_t workers = std::min(WorkerCount(), (n + minPerWorker - 1) / minPerWorker);
+	if (workers <= 1) {
+		if (n > 0) fn(size_t(0), n);
+		return;
+	}
+	const size_t chunk = (n + workers - 1) / workers;
+	ThreadPool::Get().Run(workers, [&fn, n, chunk](const size_t w) {
+		const size_t begin = std::min(n, w * chunk), end = std::min(n, begin + chunk);
+		if (begin < end)
+			fn(begin, end);
+	});
+}
+
+// Exclusive prefix sum of counts into offsets (counts.size() + 1 entries).
+template<typename T>
+inline void ParallelExclusiveScan(const std::vector<T>& counts, std::vector<T>& offsets) {
+	const size_t n = counts.size();
+	offsets.resize(n + 1);
+	const size_t workers = std::min(WorkerCount(), std::max<size_t>(1, n / 65536));
+	const size_t chunk = (n + workers - 1) / workers;
+	// per-chunk totals, then a serial scan of the totals, then each chunk scans locally
+	std::vector<T> totals(workers + 1, 0);
+	ParallelFor(workers, [&](size_t b, size_t e) {
+		for (size_t w = b; w < e; w++) {
+			T sum = 0;
+			for (size_t i = w * chunk; i < std::min(n, (w + 1) * chunk); i++) sum += counts[i];
+			totals[w + 1] = sum;
+		}
+	}, 1);
+	for (size_t w = 0; w < workers; w++) totals[w + 1] += totals[w];
+	ParallelFor(workers, [&](size_t b, size_t e) {
+		for (size_t w = b; w < e; w++) {
+			T sum = totals[w];
+			for (size_t i = w * chunk; i < std::min(n, (w + 1) * chunk); i++) {
+				offsets[i] = sum;
+				sum += counts[i];
+			}
+		}
+	}, 1);
+	offsets[n] = totals[workers];
+}
+
+}
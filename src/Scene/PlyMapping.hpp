@@ -0,0 +1,331 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+
+namespace vkDelTet {
+
+enum class PlyFormat { eUnknown, eAscii, eBinaryLittleEndian, eBinaryBigEndian };
+enum class PlyType   { eInvalid, eInt8, eUInt8, eInt16, eUInt16, eInt32, eUInt32, eFloat32, eFloat64 };
+
+inline size_t PlyTypeSize(const PlyType t) {
+	switch (t) {
+		case PlyType::eInt8:    case PlyType::eUInt8:  return 1;
+		case PlyType::eInt16:   case PlyType::eUInt16: return 2;
+		case PlyType::eInt32:   case PlyType::eUInt32: case PlyType::eFloat32: return 4;
+		case PlyType::eFloat64: return 8;
+		default: return 0;
+	}
+}
+
+inline PlyType ParsePlyType(const std::string_view s) {
+	if (s == "char"   || s == "int8")    return PlyType::eInt8;
+	if (s == "uchar"  || s == "uint8")   return PlyType::eUInt8;
+	if (s == "short"  || s == "int16")   return PlyType::eInt16;
+	if (s == "ushort" || s == "uint16")  return PlyType::eUInt16;
+	if (s == "int"    || s == "int32")   return PlyType::eInt32;
+	if (s == "uint"   || s == "uint32")  return PlyType::eUInt32;
+	if (s == "float"  || s == "float32") return PlyType::eFloat32;
+	if (s == "double" || s == "float64") return PlyType::eFloat64;
+	return PlyType::eInvalid;
+}
+
+// A view of `count` records of `recordSize` bytes, each `stride` bytes apart.
+// Records are not necessarily aligned, so they are read with memcpy.
+struct StridedView {
+	const std::byte* data       = nullptr;
+	size_t           count      = 0;
+	size_t           stride     = 0;
+	size_t           recordSize = 0;
+
+	inline bool   empty() const { return count == 0; }
+	inline size_t size() const { return count; }
+	inline size_t size_bytes() const { return count * recordSize; }
+	inline bool   contiguous() const { return stride == recordSize; }
+	inline const std::byte* operator[](const size_t i) const { return data + i * stride; }
+
+	// Packs records [first, first+n) tightly into dst.
+	inline void Gather(void* dst, const size_t first, const size_t n) const {
+		std::byte* out = static_cast<std::byte*>(dst);
+		if (contiguous()) {
+			std::memcpy(out, data + first * stride, n * recordSize);
+			return;
+		}
+		for (size_t i = 0; i < n; i++)
+			std::memcpy(out + i * recordSize, data + (first + i) * stride, recordSize);
+	}
+	inline void Gather(void* dst) const { Gather(dst, 0, count); }
+
+	// Packs records order[first, first+n) tightly into dst.
+	inline void Gather(void* dst, const uint32_t* order, const size_t first, const size_t n) const {
+		std::byte* out = static_cast<std::byte*>(dst);
+		for (size_t i = 0; i < n; i++)
+			std::memcpy(out + i * recordSize, data + order[first + i] * stride, recordSize);
+	}
+
+	// Returns a view of the `size` bytes at `offset` within each record.
+	inline StridedView Field(const size_t offset, const size_t size) const {
+		return StridedView{ data + offset, count, stride, size };
+	}
+};
+
+// Typed strided view. T must be trivially copyable and exactly recordSize bytes.
+template<typename T>
+struct StridedSpan : public StridedView {
+	StridedSpan() = default;
+	inline StridedSpan(const StridedView& v) : StridedView(v) {}
+
+	inline T operator[](const size_t i) const {
+		T v;
+		std::memcpy(&v, data + i * stride, sizeof(T));
+		return v;
+	}
+
+	struct iterator {
+		const StridedSpan* span;
+		size_t i;
+		inline T operator*() const { return (*span)[i]; }
+		inline iterator& operator++() { i++; return *this; }
+		inline bool operator==(const iterator& rhs) const { return i == rhs.i; }
+	};
+	inline iterator begin() const { return iterator{ this, 0 }; }
+	inline iterator end()   const { return iterator{ this, count }; }
+
+	inline void CopyTo(std::vector<T>& dst) const {
+		dst.resize(count);
+		Gather(dst.data());
+	}
+	// dst[i] = (*this)[order[i]]
+	inline void CopyTo(std::vector<T>& dst, const std::span<const uint32_t> order) const {
+		dst.resize(order.size());
+		StridedView::Gather(dst.data(), order.data(), 0, order.size());
+	}
+};
+
+struct PlyProperty {
+	std::string name;
+	PlyType     type      = PlyType::eInvalid; // item type, for list properties
+	PlyType     countType = PlyType::eInvalid; // only valid for list properties
+	bool        isList    = false;
+	uint32_t    listCount = 0;   // number of items, assumed equal in every row
+	size_t      offset    = 0;   // byte offset of the value (or first list item) within a row
+
+	inline size_t ItemSize() const { return PlyTypeSize(type); }
+	inline size_t Size() const { return isList ? PlyTypeSize(countType) + listCount * ItemSize() : ItemSize(); }
+};
+
+struct PlyElement {
+	std::string              name;
+	size_t                   count  = 0;
+	size_t                   stride = 0; // bytes per row
+	size_t                   offset = 0; // byte offset of the first row within the file
+	std::vector<PlyProperty> properties;
+
+	inline const PlyProperty* FindProperty(const std::string_view n) const {
+		auto it = std::ranges::find(properties, n, &PlyProperty::name);
+		return it == properties.end() ? nullptr : &*it;
+	}
+};
+
+// Parses the header of a PLY file once and exposes the rows of each element
+// as strided views straight into a memory mapping of the file.
+// Only binary little-endian files with fixed-size rows can be mapped;
+// Open() fails for anything else and Format() reports what was found.
+class PlyMapping {
+private:
+	MappedFile              mFile;
+	PlyFormat               mFormat = PlyFormat::eUnknown;
+	std::vector<PlyElement> mElements;
+
+	inline static std::optional<uint64_t> ReadListCount(const std::byte* p, const PlyType t) {
+		switch (t) {
+			case PlyType::eInt8:
+			case PlyType::eUInt8:  { uint8_t  v; std::memcpy(&v, p, 1); return v; }
+			case PlyType::eInt16:
+			case PlyType::eUInt16: { uint16_t v; std::memcpy(&v, p, 2); return v; }
+			case PlyType::eInt32:
+			case PlyType::eUInt32: { uint32_t v; std::memcpy(&v, p, 4); return v; }
+			default: return std::nullopt;
+		}
+	}
+
+	inline bool ParseHeader() {
+		const std::string_view text((const char*)mFile.data(), mFile.size());
+		size_t pos = 0;
+		auto nextLine = [&]() -> std::optional<std::string_view> {
+			if (pos >= text.size()) return std::nullopt;
+			size_t end = text.find('\n', pos);
+			if (end == std::string_view::npos) return std::nullopt;
+			std::string_view line = text.substr(pos, end - pos);
+			pos = end + 1;
+			if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+			return line;
+		};
+		auto split = [](std::string_view line) {
+			std::vector<std::string_view> tokens;
+			while (!line.empty()) {
+				const size_t s = line.find_first_not_of(' ');
+				if (s == std::string_view::npos) break;
+				line.remove_prefix(s);
+				const size_t e = line.find(' ');
+				tokens.emplace_back(line.substr(0, e));
+				line.remove_prefix(e == std::string_view::npos ? line.size() : e);
+			}
+			return tokens;
+		};
+
+		if (nextLine() != "ply")
+			return false;
+
+		while (auto line = nextLine()) {
+			const auto tokens = split(*line);
+			if (tokens.empty() || tokens[0] == "comment" || tokens[0] == "obj_info")
+				continue;
+			if (tokens[0] == "end_header") {
+				// rows start right after the header; lay out each element sequentially
+				size_t offset = pos;
+				for (PlyElement& e : mElements) {
+					e.offset = offset;
+					e.stride = 0;
+					for (PlyProperty& prop : e.properties) {
+						if (prop.isList) {
+							// the list length is read from the first row and checked against every other one below
+							if (e.count == 0 || offset + e.stride + PlyTypeSize(prop.countType) > mFile.size())
+								return false;
+							const auto n = ReadListCount(mFile.data() + offset + e.stride, prop.countType);
+							if (!n) return false;
+							prop.listCount = (uint32_t)*n;
+							prop.offset = e.stride + PlyTypeSize(prop.countType);
+						} else {
+							prop.offset = e.stride;
+						}
+						e.stride += prop.Size();
+					}
+					offset += e.stride * e.count;
+					if (offset > mFile.size())
+						return false;
+					// variable-length lists can't be mapped with a fixed stride. Rows that happen to line up
+					// at the ends would still make every view and in-place patch land at the wrong offsets.
+					for (const PlyProperty& prop : e.properties) {
+						if (!prop.isList || e.count < 2) continue;
+						const std::byte* counts = mFile.data() + e.offset + prop.offset - PlyTypeSize(prop.countType);
+						std::atomic<bool> fixed = true;
+						ParallelFor(e.count, [&](size_t begin, size_t end) {
+							for (size_t row = begin; row < end && fixed.load(std::memory_order_relaxed); row++)
+								if (ReadListCount(counts + row * e.stride, prop.countType) != prop.listCount)
+									fixed = false;
+						});
+						if (!fixed)
+							return false;
+					}
+				}
+				return true;
+			}
+			if (tokens[0] == "format" && tokens.size() >= 2) {
+				if      (tokens[1] == "ascii")                mFormat = PlyFormat::eAscii;
+				else if (tokens[1] == "binary_little_endian") mFormat = PlyFormat::eBinaryLittleEndian;
+				else if (tokens[1] == "binary_big_endian")    mFormat = PlyFormat::eBinaryBigEndian;
+				if (mFormat != PlyFormat::eBinaryLittleEndian)
+					return false;
+			} else if (tokens[0] == "element" && tokens.size() >= 3) {
+				PlyElement& e = mElements.emplace_back();
+				e.name = std::string(tokens[1]);
+				std::from_chars(tokens[2].data(), tokens[2].data() + tokens[2].size(), e.count);
+			} else if (tokens[0] == "property" && !mElements.empty()) {
+				PlyProperty prop;
+				if (tokens.size() >= 5 && tokens[1] == "list") {
+					prop.isList    = true;
+					prop.countType = ParsePlyType(tokens[2]);
+					prop.type      = ParsePlyType(tokens[3]);
+					prop.name      = std::string(tokens[4]);
+				} else if (tokens.size() >= 3) {
+					prop.type = ParsePlyType(tokens[1]);
+					prop.name = std::string(tokens[2]);
+				}
+				if (prop.type == PlyType::eInvalid || (prop.isList && prop.countType == PlyType::eInvalid))
+					return false;
+				mElements.back().properties.emplace_back(std::move(prop));
+			}
+		}
+		return false;
+	}
+
+public:
+	// A writable mapping is for patching rows in place (PlyPatch.hpp), so it isn't read ahead.
+	inline bool Open(const std::filesystem::path& p, const bool writable = false) {
+		mElements.clear();
+		mFormat = PlyFormat::eUnknown;
+		if (!mFile.Open(p, writable))
+			return false;
+		if (!ParseHeader() || mFormat != PlyFormat::eBinaryLittleEndian) {
+			mFile.Close();
+			return false;
+		}
+		if (!writable)
+			mFile.AdviseSequential();
+		return true;
+	}
+
+	inline void Close() {
+		mFile.Close();
+		mElements.clear();
+	}
+
+	inline PlyFormat Format() const { return mFormat; }
+	inline const MappedFile& File() const { return mFile; }
+	inline const std::vector<PlyElement>& Elements() const { return mElements; }
+	inline explicit operator bool() const { return (bool)mFile; }
+
+	inline const PlyElement* FindElement(const std::string_view name) const {
+		auto it = std::ranges::find(mElements, name, &PlyElement::name);
+		return it == mElements.end() ? nullptr : &*it;
+	}
+
+	// View of every row of an element.
+	inline StridedView Rows(const PlyElement& e) const {
+		return StridedView{ mFile.data() + e.offset, e.count, e.stride, e.stride };
+	}
+
+	// Views a run of properties that are stored back to back within each row
+	// (e.g. x, y, z) as one record per row. Returns an empty view if any property is
+	// missing, is not of the given type, or the properties are not adjacent.
+	inline StridedView Properties(const std::string_view element, const std::vector<std::string>& names, const PlyType type) const {
+		const PlyElement* e = FindElement(element);
+		if (!e || names.empty())
+			return {};
+		size_t begin = 0, end = 0;
+		for (size_t i = 0; i < names.size(); i++) {
+			const PlyProperty* prop = e->FindProperty(names[i]);
+			if (!prop || prop->isList || prop->type != type)
+				return {};
+			if (i == 0)
+				begin = end = prop->offset;
+			if (prop->offset != end)
+				return {};
+			end += prop->ItemSize();
+		}
+		return Rows(*e).Field(begin, end - begin);
+	}
+
+	// Views the items of a fixed-length list property (e.g. tetrahedron indices).
+	inline StridedView ListItems(const std::string_view element, const std::string_view name, const uint32_t expectedCount) const {
+		const PlyElement* e = FindElement(element);
+		if (!e) return {};
+		const PlyProperty* prop = e->FindProperty(name);
+		if (!prop || !prop->isList || prop->listCount != expectedCount)
+			return {};
+		return Rows(*e).Field(prop->offset, prop->listCount * prop->ItemSize());
+	}
+};
+
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <span>
+#include <vector>
+
+#include "PlyMapping.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace vkDelTet {
+
+// In-place patching of fixed-size fields in a binary PLY, made crash safe with a redo journal.
+//
+//   [PlyJournalHeader][PlyPatch x count]    written to <file>.journal
+//
+// The journal is written and fsync'd before the first byte of the PLY changes, and removed once
+// the patched mapping has been flushed. A journal left behind by a crash is replayed by
+// RecoverPlyJournal; patches are idempotent, so replaying a completed save is harmless. A torn
+// journal (crash while writing it) fails its checksum and is discarded, since the PLY was never touched.
+
+static constexpr uint32_t kPlyJournalMagic   = 0x4c4a4d52; // "RMJL"
+static constexpr uint32_t kPlyJournalVersion = 1;
+
+// One 4-byte field at a file offset. Every attribute an edit can change is a float.
+struct PlyPatch {
+	uint64_t offset;
+	uint32_t bits;
+	uint32_t reserved = 0;
+};
+
+struct PlyJournalHeader {
+	uint32_t magic    = kPlyJournalMagic;
+	uint32_t version  = kPlyJournalVersion;
+	uint64_t count    = 0;
+	uint64_t fileSize = 0; // size of the PLY the patches apply to
+	uint64_t checksum = 0; // FNV-1a of the patches
+};
+
+inline uint64_t Fnv1a(const std::span<const std::byte> bytes) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (const std::byte b : bytes) {
+		h ^= (uint64_t)b;
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+inline std::filesystem::path PlyJournalPath(const std::filesystem::path& p) {
+	return std::filesystem::path(p).concat(".journal");
+}
+
+// Writes bytes to p and waits until they are on disk.
+inline bool WriteFileDurable(const std::filesystem::path& p, const std::span<const std::byte> bytes) {
+#ifdef _WIN32
+	const HANDLE file = CreateFileW(p.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD written = 0;
+	const bool ok = WriteFile(file, bytes.data(), (DWORD)bytes.size(), &written, nullptr) && written == bytes.size() && FlushFileBuffers(file);
+	CloseHandle(file);
+	return ok;
+#else
+	const int fd = ::open(p.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	size_t written = 0;
+	while (written < bytes.size()) {
+		const ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+		if (n <= 0)
+			break;
+		written += (size_t)n;
+	}
+	const bool ok = written == bytes.size() && ::fsync(fd) == 0;
+	::close(fd);
+	return ok;
+#endif
+}
+
+inline void ApplyPlyPatches(const MappedFile& file, const std::span<const PlyPatch> patches) {
+	std::byte* data = file.writable_data();
+	for (const PlyPatch& patch : patches)
+		std::memcpy(data + patch.offset, &patch.bits, sizeof(patch.bits));
+}
+
+// Replays the journal of an interrupted patch of p, if there is one. Returns false only if
+// a valid journal exists but could not be applied.
+inline bool RecoverPlyJournal(const std::filesystem::path& p) {
+	const std::filesystem::path journalPath = PlyJournalPath(p);
+	if (!std::filesystem::exists(journalPath))
+		return true;
+
+	MappedFile journal;
+	PlyJournalHeader header;
+	bool valid = journal.Open(journalPath) && journal.size() >= sizeof(header);
+	if (valid) {
+		std::memcpy(&header, journal.data(), sizeof(header));
+		valid = header.magic == kPlyJournalMagic && header.version == kPlyJournalVersion &&
+			journal.size() == sizeof(header) + header.count * sizeof(PlyPatch) &&
+			Fnv1a(journal.Bytes().subspan(sizeof(header))) == header.checksum;
+	}
+	if (valid) {
+		MappedFile file;
+		if (!file.Open(p, true) || file.size() != header.fileSize) {
+			std::cerr << "Can't replay " << journalPath << ": " << p << " is missing or has changed size." << std::endl;
+			return false;
+		}
+		std::vector<PlyPatch> patches(header.count);
+		std::memcpy(patches.data(), journal.data() + sizeof(header), patches.size() * sizeof(PlyPatch));
+		for (const PlyPatch& patch : patches) {
+			if (patch.offset + sizeof(patch.bits) > file.size()) {
+				std::cerr << "Can't replay " << journalPath << ": patch out of range." << std::endl;
+				return false;
+			}
+		}
+		ApplyPlyPatches(file, patches);
+		if (!file.Flush()) {
+			std::cerr << "Failed to flush " << p << std::endl;
+			return false;
+		}
+		std::cout << "Replayed " << patches.size() << " patches from " << journalPath << std::endl;
+	} else
+		std::cerr << "Discarding incomplete journal " << journalPath << std::endl;
+
+	journal.Close();
+	std::error_code ec;
+	std::filesystem::remove(journalPath, ec);
+	return true;
+}
+
+// Patches the fields of ply in place. The mapping must be writable.
+inline bool PatchPly(const std::filesystem::path& p, const PlyMapping& ply, const std::span<const PlyPatch> patches) {
+	if (patches.empty())
+		return true;
+
+	PlyJournalHeader header;
+	header.count    = patches.size();
+	header.fileSize = ply.File().size();
+	header.checksum = Fnv1a(std::as_bytes(patches));
+	std::vector<std::byte> journal(sizeof(header) + patches.size_bytes());
+	std::memcpy(journal.data(), &header, sizeof(header));
+	std::memcpy(journal.data() + sizeof(header), patches.data(), patches.size_bytes());
+
+	const std::filesystem::path journalPath = PlyJournalPath(p);
+	if (!WriteFileDurable(journalPath, journal)) {
+		std::cerr << "Failed to write " << journalPath << std::endl;
+		return false;
+	}
+
+	ApplyPlyPatches(ply.File(), patches);
+	if (!ply.File().Flush()) {
+		// the journal stays behind and is replayed by the next RecoverPlyJournal
+		std::cerr << "Failed to flush " << p << std::endl;
+		return false;
+	}
+
+	std::error_code ec;
+	std::filesystem::remove(journalPath, ec);
+	return true;
+}
+
+}
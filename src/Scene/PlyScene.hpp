@@ -0,0 +1,160 @@
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <ranges>
+
+#include <tinyply.h>
+#include <Rose/Core/RoseEngine.h>
+
+#include "PlyMapping.hpp"
+
+// matches the value in EvaluateSH.cs.slang
+#define COEFFS_PER_BUF 16
+
+namespace vkDelTet {
+
+using namespace RoseEngine;
+
+
+// Views of the scene attributes inside a PLY file. Both the memory-mapped and the
+// tinyply paths produce these, so everything after parsing is shared.
+struct PlySceneViews {
+	StridedSpan<float3>      positions;
+	StridedSpan<uint4>       indices;
+	StridedSpan<float>       densities;
+	StridedSpan<float3>      gradients;
+	std::vector<StridedView> sh; // one view per SH buffer, 3 floats per coefficient
+	uint32_t                 numSHCoeffs = 0;
+};
+
+// Groups the sh_N_r/g/b properties of the tetrahedron element into buffers of COEFFS_PER_BUF coefficients.
+inline std::vector<std::vector<std::string>> FindSHProperties(const std::ranges::range auto& propertyNames) {
+	int32_t minSH = std::numeric_limits<int32_t>::max();
+	int32_t maxSH = -1;
+	for (const std::string& name : propertyNames) {
+		if (!name.starts_with("sh_"))
+			continue;
+		int32_t sh_i;
+		if (sscanf(name.c_str(), "sh_%d", &sh_i) > 0)
+		{
+			minSH = min(minSH, sh_i);
+			maxSH = max(maxSH, sh_i);
+		}
+	}
+
+	std::vector<std::vector<std::string>> sh_props;
+	for (int32_t i = minSH; i <= maxSH; i++) {
+		const auto prefix = "sh_" + std::to_string(i);
+		const uint32_t bufId = (i - minSH) / COEFFS_PER_BUF;
+		if (bufId <= sh_props.size()) sh_props.resize(bufId + 1);
+		sh_props[bufId].emplace_back(prefix + "_r");
+		sh_props[bufId].emplace_back(prefix + "_g");
+		sh_props[bufId].emplace_back(prefix + "_b");
+	}
+	return sh_props;
+}
+
+inline bool GetMappedViews(const PlyMapping& ply, PlySceneViews& views) {
+	const PlyElement* tet_element = ply.FindElement("tetrahedron");
+	if (!ply.FindElement("vertex") || !tet_element)
+		return false;
+
+	const auto sh_props = FindSHProperties(tet_element->properties | std::views::transform(&PlyProperty::name));
+
+	views.positions = ply.Properties("vertex", { "x", "y", "z" }, PlyType::eFloat32);
+	views.indices   = ply.ListItems("tetrahedron", "indices", 4);
+	views.densities = ply.Properties("tetrahedron", { "s" }, PlyType::eFloat32);
+	views.gradients = ply.Properties("tetrahedron", { "grd_x", "grd_y", "grd_z" }, PlyType::eFloat32);
+	views.sh.resize(sh_props.size());
+	views.numSHCoeffs = 0;
+	for (uint32_t i = 0; i < sh_props.size(); i++) {
+		views.sh[i] = ply.Properties("tetrahedron", sh_props[i], PlyType::eFloat32);
+		if (views.sh[i].empty())
+			return false;
+		views.numSHCoeffs += (uint32_t)sh_props[i].size() / 3;
+	}
+
+	const PlyProperty* inds = tet_element->FindProperty("indices");
+	return !views.positions.empty() && !views.indices.empty() && !views.densities.empty() && !views.gradients.empty()
+		&& inds->ItemSize() == sizeof(uint32_t);
+}
+
+inline bool ReadTinyplyViews(const std::filesystem::path& p, PlySceneViews& views, std::vector<std::shared_ptr<tinyply::PlyData>>& plyData) {
+	std::ifstream file;
+	file.open(p, std::ios::binary);
+
+	tinyply::PlyFile ply;
+	ply.parse_header(file);
+	const auto elements = ply.get_elements();
+
+	if (std::ranges::find(elements, "vertex", &tinyply::PlyElement::name) == elements.end()) {
+		std::cerr << "No vertex element in ply file." << std::endl;
+		return false;
+	}
+	auto tet_element = std::ranges::find(elements, "tetrahedron", &tinyply::PlyElement::name);
+	if (tet_element == elements.end()) {
+		std::cerr << "No tetrahedron element in ply file." << std::endl;
+		return false;
+	}
+
+	const auto sh_props = FindSHProperties(tet_element->properties | std::views::transform(&tinyply::PlyProperty::name));
+
+	auto ply_vertices      = ply.request_properties_from_element("vertex", { "x", "y", "z" });
+	auto ply_tet_indices   = ply.request_properties_from_element("tetrahedron", { "indices" }, 4);
+	auto ply_tet_densities = ply.request_properties_from_element("tetrahedron", { "s" });
+	auto ply_tet_gradients = ply.request_properties_from_element("tetrahedron", { "grd_x", "grd_y", "grd_z" });
+	std::vector<std::shared_ptr<tinyply::PlyData>> ply_vertex_sh(sh_props.size());
+	for (uint32_t i = 0; i < sh_props.size(); i++)
+		ply_vertex_sh[i] = ply.request_properties_from_element("tetrahedron", sh_props[i]);
+
+	ply.read(file);
+
+	auto getPlyView = [&](const auto& ply_data, const size_t recordSize) {
+		plyData.emplace_back(ply_data);
+		const size_t n = ply_data->buffer.size_bytes() / recordSize;
+		return StridedView{ reinterpret_cast<const std::byte*>(ply_data->buffer.get()), n, recordSize, recordSize };
+	};
+
+	views.positions = getPlyView(ply_vertices,      sizeof(float3));
+	views.indices   = getPlyView(ply_tet_indices,   sizeof(uint4));
+	views.densities = getPlyView(ply_tet_densities, sizeof(float));
+	views.gradients = getPlyView(ply_tet_gradients, sizeof(float3));
+	views.sh.resize(sh_props.size());
+	views.numSHCoeffs = 0;
+	for (uint32_t i = 0; i < sh_props.size(); i++) {
+		views.sh[i] = getPlyView(ply_vertex_sh[i], sh_props[i].size() * sizeof(float));
+		views.numSHCoeffs += (uint32_t)sh_props[i].size() / 3;
+	}
+	return true;
+}
+
+// Opens a checkpoint and owns whatever backs the views: a mapping of the file,
+// or tinyply's heap buffers for files that can't be mapped.
+struct PlySceneSource {
+	PlyMapping                                     mapping;
+	std::vector<std::shared_ptr<tinyply::PlyData>> plyData;
+	PlySceneViews                                  views;
+
+	inline bool Open(const std::filesystem::path& p) {
+		// Binary little-endian files are mapped and read in place. Anything else
+		// (ASCII, big-endian, variable-length lists) goes through tinyply.
+		if (mapping.Open(p)) {
+			if (!GetMappedViews(mapping, views)) {
+				std::cerr << "Missing or unsupported vertex/tetrahedron properties in ply file." << std::endl;
+				return false;
+			}
+		} else {
+			if (!ReadTinyplyViews(p, views, plyData))
+				return false;
+		}
+		if (views.sh.empty()) {
+			std::cerr << "No colors in ply file." << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
+
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Parallel.hpp"
+#include "PlyMapping.hpp"
+
+namespace vkDelTet {
+
+inline const char* PlyTypeName(const PlyType t) {
+	switch (t) {
+		case PlyType::eInt8:    return "char";
+		case PlyType::eUInt8:   return "uchar";
+		case PlyType::eInt16:   return "short";
+		case PlyType::eUInt16:  return "ushort";
+		case PlyType::eInt32:   return "int";
+		case PlyType::eUInt32:  return "uint";
+		case PlyType::eFloat32: return "float";
+		case PlyType::eFloat64: return "double";
+		default: return "invalid";
+	}
+}
+
+// Writes a binary little-endian PLY file with fixed-size rows.
+//
+// Rows are serialized in parallel into a chunk-sized buffer, and each chunk is written
+// with one large sequential write while the workers fill the next one. The file is written
+// next to p and renamed into place by Close(), so a failed save never clobbers the original.
+class PlyWriter {
+private:
+	std::ostringstream    mHeader;
+	std::ofstream         mFile;
+	std::filesystem::path mPath, mTmpPath;
+	size_t                mChunkSize;
+
+public:
+	inline explicit PlyWriter(const size_t chunkSize = 64 << 20) : mChunkSize(chunkSize) {
+		mHeader << "ply\nformat binary_little_endian 1.0\n";
+	}
+
+	inline void Comment(const std::string_view text) { mHeader << "comment " << text << "\n"; }
+	inline void Element(const std::string_view name, const size_t count) { mHeader << "element " << name << " " << count << "\n"; }
+	inline void Property(const PlyType type, const std::string_view name) { mHeader << "property " << PlyTypeName(type) << " " << name << "\n"; }
+	inline void ListProperty(const PlyType countType, const PlyType itemType, const std::string_view name) {
+		mHeader << "property list " << PlyTypeName(countType) << " " << PlyTypeName(itemType) << " " << name << "\n";
+	}
+
+	// Opens the temporary file and writes the header declared so far.
+	inline bool Open(const std::filesystem::path& p) {
+		mPath    = p;
+		mTmpPath = std::filesystem::path(p).concat(".tmp");
+		mFile.open(mTmpPath, std::ios::binary | std::ios::trunc);
+		if (!mFile) {
+			std::cerr << "Failed to open " << mTmpPath << " for writing." << std::endl;
+			return false;
+		}
+		mHeader << "end_header\n";
+		const std::string header = mHeader.str();
+		mFile.write(header.data(), header.size());
+		return (bool)mFile;
+	}
+
+	// Writes count rows of rowSize bytes. serialize(first, last, dst) writes rows [first, last) to dst
+	// and is called concurrently for disjoint ranges.
+	template<typename Serialize>
+	inline bool WriteRows(const size_t count, const size_t rowSize, Serialize&& serialize) {
+		const size_t rowsPerChunk = std::max<size_t>(1, mChunkSize / rowSize);
+		std::vector<std::byte> buffers[2];
+		std::future<void> pending;
+		for (size_t first = 0, chunk = 0; first < count; first += rowsPerChunk, chunk++) {
+			const size_t n = std::min(rowsPerChunk, count - first);
+			std::vector<std::byte>& buffer = buffers[chunk % 2];
+			buffer.resize(n * rowSize);
+			ParallelFor(n, [&](size_t begin, size_t end) {
+				serialize(first + begin, first + end, buffer.data() + begin * rowSize);
+			}, 1024);
+			if (pending.valid())
+				pending.get();
+			pending = std::async(std::launch::async, [this, &buffer]() {
+				mFile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+			});
+		}
+		if (pending.valid())
+			pending.get();
+		return (bool)mFile;
+	}
+
+	inline bool Close() {
+		mFile.close();
+		if (!mFile) {
+			std::cerr << "Failed to write " << mTmpPath << std::endl;
+			return false;
+		}
+		std::error_code ec;
+		std::filesystem::rename(mTmpPath, mPath, ec);
+		if (ec) {
+			std::cerr << "Failed to rename " << mTmpPath << ": " << ec.message() << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
+
+}
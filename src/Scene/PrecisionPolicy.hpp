@@ -0,0 +1,83 @@
+#pragma once
+
+#include "SHQuantize.hpp"
+#include "VertexQuantize.hpp"
+
+namespace vkDelTet {
+
+// Must match kPrecision* in TetrahedronScene.slang
+enum class Precision : uint32_t {
+	eFloat32 = 0,
+	eFloat16 = 1,
+};
+
+inline const char* PrecisionName(const Precision p) {
+	switch (p) {
+		case Precision::eFloat32: return "fp32";
+		case Precision::eFloat16: return "fp16";
+		default: return "unknown";
+	}
+}
+
+// Must match kColorFormat* in TetrahedronScene.slang. fp32 and fp16 share their values with Precision.
+enum class ColorFormat : uint32_t {
+	eFloat32   = 0, // float3, 12 bytes
+	eFloat16   = 1, // 4 halves (the last one unused), 8 bytes
+	eSharedExp = 2, // sign and 8 bit magnitude per channel with a shared 5 bit exponent, 4 bytes
+};
+
+inline const char* ColorFormatName(const ColorFormat f) {
+	switch (f) {
+		case ColorFormat::eFloat32:   return "fp32";
+		case ColorFormat::eFloat16:   return "fp16";
+		case ColorFormat::eSharedExp: return "shared exponent";
+		default: return "unknown";
+	}
+}
+
+// Storage format of every per-vertex and per-tet attribute that has a choice. Load allocates
+// and converts according to it, the edit paths encode through it, and the shaders decode
+// through the matching TetrahedronScene.slang accessors. The CPU mirrors are always fp32.
+//
+//   vertices   float3 or 21-21-22 bit fixed point (uint2)
+//   densities  texel buffer, R32Sfloat or R16Sfloat
+//   gradients  float3, or 4 halves (uint2, the last one zero) so fetches stay aligned
+//   sh         see SHQuantize.hpp
+//   colors     RenderContext::evaluatedColors, written by EvaluateSH every frame, see ColorFormat
+struct PrecisionPolicy {
+	VertexFormat vertices  = VertexFormat::eFloat32;
+	Precision    densities = Precision::eFloat32;
+	Precision    gradients = Precision::eFloat32;
+	SHFormat     sh        = SHFormat::eFloat16;
+	ColorFormat  colors    = ColorFormat::eFloat32;
+
+	inline size_t VertexSize()   const { return vertices  == VertexFormat::eUNorm21 ? sizeof(uint2)    : sizeof(float3); }
+	inline size_t DensitySize()  const { return densities == Precision::eFloat16    ? sizeof(uint16_t) : sizeof(float); }
+	inline size_t GradientSize() const { return gradients == Precision::eFloat16    ? sizeof(uint2)    : sizeof(float3); }
+	inline size_t ColorSize()    const {
+		switch (colors) {
+			case ColorFormat::eFloat16:   return sizeof(uint2);
+			case ColorFormat::eSharedExp: return sizeof(uint32_t);
+			default:                      return sizeof(float3);
+		}
+	}
+
+	inline bool operator==(const PrecisionPolicy&) const = default;
+
+	// Exact positions and fp32 everywhere but SH, which loads as fp16 unless asked otherwise
+	inline static constexpr PrecisionPolicy Full() { return {}; }
+	// fp16 for everything that tolerates it. Vertices stay fp32; quantizing them is a separate choice,
+	// since it moves the tet faces.
+	inline static constexpr PrecisionPolicy Half() {
+		return { VertexFormat::eFloat32, Precision::eFloat16, Precision::eFloat16, SHFormat::eFloat16, ColorFormat::eFloat16 };
+	}
+};
+
+// Policy new scenes start with. Builds with RMVK_HALF_PRECISION default to fp16 everywhere.
+#ifdef RMVK_HALF_PRECISION
+inline constexpr PrecisionPolicy kDefaultPrecision = PrecisionPolicy::Half();
+#else
+inline constexpr PrecisionPolicy kDefaultPrecision = PrecisionPolicy::Full();
+#endif
+
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <span>
+#include <unordered_set>
+
+#include "Csr.hpp"
+#include "SHQuantize.hpp"
+
+namespace vkDelTet {
+
+// Vector-quantized SH buffer. The DC term of the first buffer stays per tet (fp16);
+// every other coefficient of a tet is replaced by one entry of a trained codebook.
+//
+//   [uint16 entry per tet, padded to 4][fp16 rgb DC per tet, padded to 4 (buffer 0 only)][float3 x coeffsPerBuf per entry]
+//
+// The codebook is a two level k-means tree (kSHCodebookBranching^2 leaves), so
+// assigning tens of millions of tets costs 2 * kSHCodebookBranching distances each
+// instead of one per codebook entry. Both levels are trained with mini-batch k-means.
+static constexpr uint32_t kSHCodebookBranching = 64;
+static constexpr uint32_t kSHCodebookSize      = kSHCodebookBranching * kSHCodebookBranching;
+
+inline size_t SHCodebookIndexSize(const size_t numTets) { return (numTets * sizeof(uint16_t) + 3) & ~size_t(3); }
+inline size_t SHCodebookDCSize   (const size_t numTets) { return (numTets * sizeof(uint16_t) * 3 + 3) & ~size_t(3); }
+
+inline size_t SHCodebookSize(const size_t numTets, const uint32_t coeffsPerBuf, const bool hasDC) {
+	return SHCodebookIndexSize(numTets) + (hasDC ? SHCodebookDCSize(numTets) : 0) + kSHCodebookSize * coeffsPerBuf * 3 * sizeof(float);
+}
+
+// Returns the index of the center closest to x.
+inline uint32_t NearestCenter(const float* x, const float* centers, const uint32_t k, const uint32_t dim) {
+	uint32_t best = 0;
+	float bestDist = INFINITY;
+	for (uint32_t c = 0; c < k; c++) {
+		const float* center = centers + c * dim;
+		float d = 0;
+		for (uint32_t i = 0; i < dim && d < bestDist; i++) {
+			const float e = x[i] - center[i];
+			d += e * e;
+		}
+		if (d < bestDist) {
+			bestDist = d;
+			best = c;
+		}
+	}
+	return best;
+}
+
+// Mini-batch k-means (Sculley 2010) over `count` points. point(i, float* x) writes the dim floats of point i.
+// Returns up to k centers; fewer if there are fewer points than k.
+template<typename Point>
+inline std::vector<float> MiniBatchKMeans(const size_t count, const uint32_t dim, const uint32_t k, Point&& point, std::mt19937_64& rng, const uint32_t iterations = 48, const uint32_t batchSize = 8192) {
+	if (count <= k) {
+		std::vector<float> centers(count * dim);
+		for (size_t i = 0; i < count; i++)
+			point(i, centers.data() + i * dim);
+		return centers;
+	}
+
+	// seed with distinct random points (Floyd's sampling)
+	std::vector<float> centers(size_t(k) * dim);
+	{
+		std::unordered_set<size_t> seeds;
+		for (size_t j = count - k; j < count; j++) {
+			const size_t i = std::uniform_int_distribution<size_t>(0, j)(rng);
+			seeds.insert(seeds.contains(i) ? j : i);
+		}
+		std::vector<size_t> sorted(seeds.begin(), seeds.end());
+		std::ranges::sort(sorted);
+		for (uint32_t c = 0; c < k; c++)
+			point(sorted[c], centers.data() + c * dim);
+	}
+
+	const size_t batch = std::min<size_t>(batchSize, count);
+	std::vector<uint32_t> counts(k, 0);
+	std::vector<float>    samples(batch * dim);
+	std::vector<uint32_t> assignment(batch);
+	std::uniform_int_distribution<size_t> pick(0, count - 1);
+	for (uint32_t it = 0; it < iterations; it++) {
+		for (size_t i = 0; i < batch; i++)
+			point(pick(rng), samples.data() + i * dim);
+		ParallelFor(batch, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				assignment[i] = NearestCenter(samples.data() + i * dim, centers.data(), k, dim);
+		}, 256);
+		// per-center learning rate 1/n keeps every center the running mean of its samples
+		for (size_t i = 0; i < batch; i++) {
+			const uint32_t c = assignment[i];
+			const float eta = 1.f / float(++counts[c]);
+			float* center = centers.data() + c * dim;
+			const float* x = samples.data() + i * dim;
+			for (uint32_t d = 0; d < dim; d++)
+				center[d] += eta * (x[d] - center[d]);
+		}
+	}
+	return centers;
+}
+
+// fetch(tetId, float* rgb) writes the coeffsInBuf rgb triplets of a tet, as in QuantizeSH.
+// With hasDC, coefficient 0 is kept exact and excluded from the codebook.
+template<typename Fetch>
+inline std::vector<std::byte> BuildSHCodebook(const size_t numTets, const uint32_t coeffsInBuf, const uint32_t coeffsPerBuf, const bool hasDC, Fetch&& fetch) {
+	const auto t0 = std::chrono::high_resolution_clock::now();
+
+	std::vector<std::byte> result(SHCodebookSize(numTets, coeffsPerBuf, hasDC));
+	uint16_t* entries  = reinterpret_cast<uint16_t*>(result.data());
+	uint16_t* dc       = reinterpret_cast<uint16_t*>(result.data() + SHCodebookIndexSize(numTets));
+	float*    codebook = reinterpret_cast<float*>(result.data() + SHCodebookIndexSize(numTets) + (hasDC ? SHCodebookDCSize(numTets) : 0));
+
+	const uint32_t first = hasDC ? 1 : 0;
+	const uint32_t dim   = (coeffsInBuf - std::min(first, coeffsInBuf)) * 3;
+	auto fetchRest = [&](const size_t tetId, float* x) {
+		thread_local std::vector<float> rgb;
+		rgb.resize(coeffsInBuf * 3);
+		fetch(tetId, rgb.data());
+		std::memcpy(x, rgb.data() + first * 3, dim * sizeof(float));
+	};
+
+	if (hasDC) {
+		ParallelFor(numTets, [&](size_t begin, size_t end) {
+			std::vector<float> rgb(coeffsInBuf * 3);
+			for (size_t t = begin; t < end; t++) {
+				fetch(t, rgb.data());
+				FloatToHalf(rgb.data(), dc + t * 3, 3);
+			}
+		});
+	}
+	if (dim == 0 || numTets == 0)
+		return result;
+
+	std::mt19937_64 rng(0x5348434f44454b42ull); // fixed seed, so reloading a scene reproduces its codebook
+
+	// level 1: coarse clusters over all tets
+	const std::vector<float> coarse = MiniBatchKMeans(numTets, dim, kSHCodebookBranching, fetchRest, rng);
+	const uint32_t numCoarse = (uint32_t)(coarse.size() / dim);
+
+	std::vector<uint32_t> coarseId(numTets);
+	ParallelFor(numTets, [&](size_t begin, size_t end) {
+		std::vector<float> x(dim);
+		for (size_t t = begin; t < end; t++) {
+			fetchRest(t, x.data());
+			coarseId[t] = NearestCenter(x.data(), coarse.data(), numCoarse, dim);
+		}
+	}, 1024);
+
+	CsrTable members;
+	{
+		std::vector<uint32_t> counts(numCoarse, 0);
+		for (const uint32_t c : coarseId) counts[c]++;
+		ParallelExclusiveScan(counts, members.offsets);
+		members.values.resize(numTets);
+		std::vector<uint32_t> cursor(members.offsets.begin(), members.offsets.end() - 1);
+		for (size_t t = 0; t < numTets; t++)
+			members.values[cursor[coarseId[t]]++] = (uint32_t)t;
+	}
+
+	// level 2: each coarse cluster is refined into its own block of leaves
+	std::vector<std::vector<float>> leaves(numCoarse);
+	for (uint32_t c = 0; c < numCoarse; c++) {
+		const std::span<const uint32_t> tets = members[c];
+		leaves[c] = MiniBatchKMeans(tets.size(), dim, kSHCodebookBranching, [&](size_t i, float* p) { fetchRest(tets[i], p); }, rng, 16, 2048);
+		for (uint32_t l = 0; l < leaves[c].size() / dim; l++)
+			std::memcpy(codebook + ((c * kSHCodebookBranching + l) * coeffsPerBuf + first) * 3, leaves[c].data() + l * dim, dim * sizeof(float));
+	}
+
+	ParallelFor(numTets, [&](size_t begin, size_t end) {
+		std::vector<float> x(dim);
+		for (size_t t = begin; t < end; t++) {
+			const uint32_t c = coarseId[t];
+			fetchRest(t, x.data());
+			entries[t] = (uint16_t)(c * kSHCodebookBranching + NearestCenter(x.data(), leaves[c].data(), (uint32_t)(leaves[c].size() / dim), dim));
+		}
+	}, 1024);
+
+	const auto t1 = std::chrono::high_resolution_clock::now();
+	std::cout << "Trained a " << kSHCodebookSize << " entry SH codebook for " << numTets << " tets in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << "ms" << std::endl;
+	return result;
+}
+
+// Decodes the coeffsInBuf rgb triplets of one tet from a buffer written by BuildSHCodebook, as SHCoeffs.slang does.
+inline void DecodeSHCodebook(const std::byte* data, const size_t numTets, const size_t tetId, const uint32_t coeffsInBuf, const uint32_t coeffsPerBuf, const bool hasDC, float* rgb) {
+	uint16_t entry;
+	std::memcpy(&entry, data + tetId * sizeof(uint16_t), sizeof(entry));
+	const std::byte* codebook = data + SHCodebookIndexSize(numTets) + (hasDC ? SHCodebookDCSize(numTets) : 0);
+	std::memcpy(rgb, codebook + size_t(entry) * coeffsPerBuf * 3 * sizeof(float), coeffsInBuf * 3 * sizeof(float));
+	if (hasDC && coeffsInBuf > 0) {
+		uint16_t dc[3];
+		std::memcpy(dc, data + SHCodebookIndexSize(numTets) + tetId * sizeof(dc), sizeof(dc));
+		for (uint32_t c = 0; c < 3; c++)
+			rgb[c] = HalfToFloat(dc[c]);
+	}
+}
+
+}
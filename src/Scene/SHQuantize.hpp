@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "HalfConvert.hpp"
+#include "Parallel.hpp"
+
+namespace vkDelTet {
+
+// Storage formats for the striped SH buffers. Values match SH_FORMAT in SHCoeffs.slang.
+enum class SHFormat : uint32_t {
+	eFloat32 = 0,
+	eFloat16 = 1,
+	eUNorm8  = 2,
+	eCodebook = 3, // SHCodebook.hpp
+};
+
+inline const char* SHFormatName(const SHFormat f) {
+	switch (f) {
+		case SHFormat::eFloat32: return "fp32";
+		case SHFormat::eFloat16: return "fp16";
+		case SHFormat::eUNorm8:  return "8-bit";
+		case SHFormat::eCodebook: return "codebook";
+		default: return "unknown";
+	}
+}
+
+// 8-bit block quantization of one SH buffer.
+//
+//   [uint8 rgb x coeffsPerBuf per tet, padded to 4 bytes][uint32 params x coeffsPerBuf per block]
+//
+// Tets are grouped into blocks of kSHQuantBlockSize. Every coefficient of a block has its own
+// range, stored as two halves (scale low, offset high), and decodes as offset + scale * q.
+static constexpr uint32_t kSHQuantBlockSize = 64;
+
+inline size_t SHQuantizedDataSize(const size_t numTets, const uint32_t coeffsPerBuf) {
+	return (numTets * coeffsPerBuf * 3 + 3) & ~size_t(3);
+}
+
+inline size_t SHQuantizedSize(const size_t numTets, const uint32_t coeffsPerBuf) {
+	const size_t numBlocks = (numTets + kSHQuantBlockSize - 1) / kSHQuantBlockSize;
+	return SHQuantizedDataSize(numTets, coeffsPerBuf) + numBlocks * coeffsPerBuf * sizeof(uint32_t);
+}
+
+// fetch(tetId, float* rgb) writes the coeffsInBuf rgb triplets of a tet. Slots past coeffsInBuf
+// are left zero so the stride always matches the shaders' tetId * coeffsPerBuf addressing.
+template<typename Fetch>
+inline std::vector<std::byte> QuantizeSH(const size_t numTets, const uint32_t coeffsInBuf, const uint32_t coeffsPerBuf, Fetch&& fetch) {
+	std::vector<std::byte> result(SHQuantizedSize(numTets, coeffsPerBuf));
+	uint8_t*  quantized = reinterpret_cast<uint8_t*>(result.data());
+	uint32_t* params    = reinterpret_cast<uint32_t*>(result.data() + SHQuantizedDataSize(numTets, coeffsPerBuf));
+
+	const size_t numBlocks = (numTets + kSHQuantBlockSize - 1) / kSHQuantBlockSize;
+	ParallelFor(numBlocks, [&](size_t begin, size_t end) {
+		std::vector<float> block(kSHQuantBlockSize * coeffsInBuf * 3);
+		for (size_t b = begin; b < end; b++) {
+			const size_t first = b * kSHQuantBlockSize;
+			const size_t count = std::min<size_t>(kSHQuantBlockSize, numTets - first);
+			for (size_t t = 0; t < count; t++)
+				fetch(first + t, block.data() + t * coeffsInBuf * 3);
+
+			for (uint32_t j = 0; j < coeffsPerBuf; j++) {
+				if (j >= coeffsInBuf) {
+					params[b * coeffsPerBuf + j] = 0;
+					continue;
+				}
+				float lo = INFINITY, hi = -INFINITY;
+				for (size_t t = 0; t < count; t++)
+					for (uint32_t c = 0; c < 3; c++) {
+						const float v = block[(t * coeffsInBuf + j) * 3 + c];
+						lo = std::min(lo, v);
+						hi = std::max(hi, v);
+					}
+
+				// quantize against the params the shader will actually see
+				const uint16_t offsetHalf = FloatToHalf(lo);
+				const float    offset     = HalfToFloat(offsetHalf);
+				const uint16_t scaleHalf  = FloatToHalf(std::max(hi - offset, 0.f) / 255.f);
+				const float    scale      = HalfToFloat(scaleHalf);
+				params[b * coeffsPerBuf + j] = (uint32_t)scaleHalf | ((uint32_t)offsetHalf << 16);
+
+				for (size_t t = 0; t < count; t++)
+					for (uint32_t c = 0; c < 3; c++) {
+						const float v = block[(t * coeffsInBuf + j) * 3 + c];
+						const float q = scale > 0 ? std::round((v - offset) / scale) : 0.f;
+						quantized[((first + t) * coeffsPerBuf + j) * 3 + c] = (uint8_t)std::clamp(q, 0.f, 255.f);
+					}
+			}
+		}
+	}, 64);
+	return result;
+}
+
+// Decodes the coeffsInBuf rgb triplets of one tet from a buffer written by QuantizeSH, as SHCoeffs.slang does.
+inline void DequantizeSH(const std::byte* data, const size_t numTets, const size_t tetId, const uint32_t coeffsInBuf, const uint32_t coeffsPerBuf, float* rgb) {
+	const uint8_t* quantized = reinterpret_cast<const uint8_t*>(data);
+	const std::byte* params  = data + SHQuantizedDataSize(numTets, coeffsPerBuf);
+	for (uint32_t j = 0; j < coeffsInBuf; j++) {
+		uint32_t p;
+		std::memcpy(&p, params + ((tetId / kSHQuantBlockSize) * coeffsPerBuf + j) * sizeof(uint32_t), sizeof(p));
+		const float scale  = HalfToFloat((uint16_t)(p & 0xFFFF));
+		const float offset = HalfToFloat((uint16_t)(p >> 16));
+		for (uint32_t c = 0; c < 3; c++)
+			rgb[j * 3 + c] = offset + scale * float(quantized[(tetId * coeffsPerBuf + j) * 3 + c]);
+	}
+}
+
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+#include "MappedFile.hpp"
+#include "PackedScene.hpp"
+#include "PlyPatch.hpp"
+
+namespace vkDelTet {
+
+// On-disk cache of the data Load derives from a checkpoint (spatial order, encoded SH,
+// circumspheres, centroids, offsets, CSR adjacency), stored as packed scenes.
+//
+// Entries are keyed by a hash of the checkpoint's size, modification time, header and a fixed set
+// of sampled blocks, plus the load settings that change the derived data. Hashing samples keeps a
+// lookup to a few MB of reads however large the checkpoint is; the modification time catches edits
+// that land between samples (SaveChanges patches only a handful of floats).
+//
+// Misses are baked on a background thread after the scene has loaded normally. Hits refresh the
+// entry's modification time, and the least recently used entries are evicted past the size limit.
+// Exports to a chosen path are baked on the same thread, but are not cache entries.
+class SceneCache {
+public:
+	struct Settings {
+		bool    enabled  = true;
+		size_t  maxBytes = size_t(8) << 30;
+	};
+
+private:
+	struct BakeJob {
+		std::filesystem::path src, dst;
+		BakeOptions           options;
+		bool                  entry = true; // in the cache directory, counted by Evict
+	};
+
+	std::filesystem::path   mDirectory;
+	Settings                mSettings;
+	std::mutex              mMutex;
+	std::condition_variable mCv;
+	std::deque<BakeJob>     mJobs;
+	std::filesystem::path   mBaking; // entry being written, so it isn't queued twice
+	bool                    mStop = false;
+	std::jthread            mWorker; // last, so it is joined before the rest is destroyed
+
+	static constexpr size_t kSampleCount = 64;
+	static constexpr size_t kSampleSize  = 64 << 10;
+
+	inline static std::filesystem::path DefaultDirectory() {
+#ifdef _WIN32
+		if (const char* local = std::getenv("LOCALAPPDATA"))
+			return std::filesystem::path(local) / "vkrm" / "cache";
+#else
+		if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+			return std::filesystem::path(xdg) / "vkrm";
+		if (const char* home = std::getenv("HOME"))
+			return std::filesystem::path(home) / ".cache" / "vkrm";
+#endif
+		return std::filesystem::temp_directory_path() / "vkrm";
+	}
+
+	// mMutex must be held
+	inline bool Queued(const std::filesystem::path& dst) const {
+		return mBaking == dst || std::ranges::any_of(mJobs, [&](const BakeJob& j) { return j.dst == dst; });
+	}
+
+	inline void WorkerLoop() {
+		while (true) {
+			BakeJob job;
+			{
+				std::unique_lock lock(mMutex);
+				mCv.wait(lock, [&]{ return mStop || !mJobs.empty(); });
+				if (mStop)
+					return;
+				job = std::move(mJobs.front());
+				mJobs.pop_front();
+				mBaking = job.dst;
+			}
+			if (job.entry) {
+				std::error_code ec;
+				std::filesystem::create_directories(mDirectory, ec);
+				std::cout << "Caching " << job.src << std::endl;
+				if (BakePackedScene(job.src, job.dst, job.options))
+					Evict();
+			} else {
+				std::cout << "Exporting " << job.src << std::endl;
+				if (BakePackedScene(job.src, job.dst, job.options))
+					std::cout << "Wrote " << job.dst << std::endl;
+			}
+			std::lock_guard lock(mMutex);
+			mBaking.clear();
+		}
+	}
+
+public:
+	inline SceneCache() : mDirectory(DefaultDirectory()) {
+		ThreadPool::Get(); // the pool must outlive the bakes running on mWorker
+		if (const char* dir = std::getenv("VKRM_CACHE_DIR"); dir && *dir)
+			mDirectory = dir;
+		mWorker = std::jthread([this]() { WorkerLoop(); });
+	}
+	inline ~SceneCache() {
+		{
+			std::lock_guard lock(mMutex);
+			mStop = true;
+		}
+		mCv.notify_all();
+	}
+
+	inline static SceneCache& Get() {
+		static SceneCache cache;
+		return cache;
+	}
+
+	inline const std::filesystem::path& Directory() const { return mDirectory; }
+	inline Settings& GetSettings() { return mSettings; }
+
+	// Sampled content hash of a file, or nullopt if it can't be read.
+	inline static std::optional<uint64_t> HashFile(const std::filesystem::path& p) {
+		MappedFile file;
+		std::error_code ec;
+		const auto mtime = std::filesystem::last_write_time(p, ec);
+		if (ec || !file.Open(p))
+			return std::nullopt;
+		const std::span<const std::byte> bytes = file.Bytes();
+		const uint64_t stamp[2] = { (uint64_t)bytes.size(), (uint64_t)mtime.time_since_epoch().count() };
+		uint64_t h = Fnv1a(std::as_bytes(std::span(stamp)));
+		auto mix = [&](const size_t offset) {
+			const size_t n = std::min(kSampleSize, bytes.size() - offset);
+			h = (h ^ Fnv1a(bytes.subspan(offset, n))) * 0x100000001b3ull;
+		};
+		mix(0); // header
+		if (bytes.size() > kSampleSize) {
+			const size_t span = bytes.size() - kSampleSize;
+			for (size_t i = 1; i <= kSampleCount; i++)
+				mix(span * i / kSampleCount);
+		}
+		return h;
+	}
+
+	// Path of the entry for a checkpoint with the given hash, loaded with the given options.
+	inline std::filesystem::path EntryPath(const uint64_t hash, const BakeOptions& options) const {
+		std::ostringstream name;
+		name << std::hex << std::setw(16) << std::setfill('0') << hash
+			<< (options.spatialReorder ? "-morton-" : "-file-") << SHFormatName(options.shFormat)
+			<< (options.dropDegenerate ? "-filtered" : "") << ".rmsh";
+		return mDirectory / name.str();
+	}
+
+	// Returns the entry if it exists, marking it as most recently used.
+	inline std::optional<std::filesystem::path> Find(const std::filesystem::path& entry) {
+		if (!mSettings.enabled)
+			return std::nullopt;
+		std::error_code ec;
+		if (!std::filesystem::is_regular_file(entry, ec))
+			return std::nullopt;
+		std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), ec);
+		return entry;
+	}
+
+	// Bakes src into entry on the background thread, unless it is already queued or being baked.
+	inline void Insert(const std::filesystem::path& src, const std::filesystem::path& entry, const BakeOptions& options) {
+		if (!mSettings.enabled)
+			return;
+		{
+			std::lock_guard lock(mMutex);
+			if (Queued(entry))
+				return;
+			mJobs.emplace_back(src, entry, options);
+		}
+		mCv.notify_all();
+	}
+
+	// Bakes src into dst on the background thread, whether or not the cache is enabled.
+	inline void Export(const std::filesystem::path& src, const std::filesystem::path& dst, const BakeOptions& options = {}) {
+		{
+			std::lock_guard lock(mMutex);
+			if (Queued(dst))
+				return;
+			mJobs.emplace_back(src, dst, options, false);
+		}
+		mCv.notify_all();
+	}
+
+	// Whether dst is queued or being baked.
+	inline bool Baking(const std::filesystem::path& dst) {
+		std::lock_guard lock(mMutex);
+		return Queued(dst);
+	}
+
+	// Total size of the cache entries.
+	inline size_t Size() const {
+		size_t total = 0;
+		std::error_code ec;
+		for (const auto& e : std::filesystem::directory_iterator(mDirectory, ec))
+			if (e.path().extension() == ".rmsh")
+				total += e.file_size(ec);
+		return total;
+	}
+
+	// Deletes the least recently used entries until the cache fits in the size limit.
+	inline void Evict() {
+		struct Entry {
+			std::filesystem::path           path;
+			size_t                          size;
+			std::filesystem::file_time_type used;
+		};
+		std::vector<Entry> entries;
+		size_t total = 0;
+		std::error_code ec;
+		for (const auto& e : std::filesystem::directory_iterator(mDirectory, ec)) {
+			if (e.path().extension() != ".rmsh")
+				continue;
+			const Entry& entry = entries.emplace_back(e.path(), (size_t)e.file_size(ec), e.last_write_time(ec));
+			total += entry.size;
+		}
+		std::ranges::sort(entries, {}, &Entry::used);
+		for (const Entry& e : entries) {
+			if (total <= mSettings.maxBytes)
+				break;
+			// an entry that is still mapped by a loaded scene can't be removed on Windows; it goes next time
+			if (std::filesystem::remove(e.path, ec)) {
+				total -= e.size;
+				std::cout << "Evicted " << e.path << " from the scene cache" << std::endl;
+			}
+		}
+	}
+
+	inline void Clear() {
+		std::error_code ec;
+		for (const auto& e : std::filesystem::directory_iterator(mDirectory, ec))
+			if (e.path().extension() == ".rmsh")
+				std::filesystem::remove(e.path(), ec);
+	}
+};
+
+}
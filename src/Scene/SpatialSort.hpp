@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <cfloat>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <Rose/Core/RoseEngine.h>
+
+#include "Parallel.hpp"
+
+namespace vkDelTet {
+
+using namespace RoseEngine;
+
+// Spreads the low 21 bits of v so that there are two zero bits between consecutive bits.
+inline uint64_t SpreadBits3(uint64_t v) {
+	v &= 0x1FFFFF;
+	v = (v | (v << 32)) & 0x001F00000000FFFFull;
+	v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+	v = (v | (v <<  8)) & 0x100F00F00F00F00Full;
+	v = (v | (v <<  4)) & 0x10C30C30C30C30C3ull;
+	v = (v | (v <<  2)) & 0x1249249249249249ull;
+	return v;
+}
+
+// 63-bit Morton code of p, quantized to 21 bits per axis over the AABB.
+inline uint64_t MortonCode(const float3 p, const float3 aabbMin, const float3 aabbMax) {
+	const float3 extent = max(aabbMax - aabbMin, float3(FLT_MIN));
+	const float3 t = clamp((p - aabbMin) / extent, float3(0), float3(1)) * float((1u << 21) - 1);
+	return SpreadBits3((uint64_t)t.x) | (SpreadBits3((uint64_t)t.y) << 1) | (SpreadBits3((uint64_t)t.z) << 2);
+}
+
+// Stable LSD radix sort of (keys, values) by key, 8 bits per pass. Each pass counts digits
+// per worker, scans the counts digit-major, then every worker scatters its own range.
+// Passes where every key has the same digit are skipped.
+inline void ParallelRadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values) {
+	const size_t n = keys.size();
+	const size_t workers = std::min(WorkerCount(), std::max<size_t>(1, n / 65536));
+	const size_t chunk = (n + workers - 1) / workers;
+
+	std::vector<uint64_t> keysTmp(n);
+	std::vector<uint32_t> valuesTmp(n);
+	std::vector<std::array<size_t, 256>> offsets(workers);
+	for (uint32_t shift = 0; shift < 64; shift += 8) {
+		ParallelFor(workers, [&](size_t b, size_t e) {
+			for (size_t w = b; w < e; w++) {
+				offsets[w].fill(0);
+				for (size_t i = w * chunk; i < std::min(n, (w + 1) * chunk); i++)
+					offsets[w][(keys[i] >> shift) & 0xFF]++;
+			}
+		}, 1);
+
+		size_t sum = 0;
+		bool trivial = false;
+		for (uint32_t d = 0; d < 256; d++) {
+			size_t digitCount = 0;
+			for (size_t w = 0; w < workers; w++) {
+				const size_t c = offsets[w][d];
+				offsets[w][d] = sum;
+				sum += c;
+				digitCount += c;
+			}
+			trivial |= digitCount == n;
+		}
+		if (trivial)
+			continue;
+
+		ParallelFor(workers, [&](size_t b, size_t e) {
+			for (size_t w = b; w < e; w++) {
+				for (size_t i = w * chunk; i < std::min(n, (w + 1) * chunk); i++) {
+					const size_t dst = offsets[w][(keys[i] >> shift) & 0xFF]++;
+					keysTmp[dst]   = keys[i];
+					valuesTmp[dst] = values[i];
+				}
+			}
+		}, 1);
+		keys.swap(keysTmp);
+		values.swap(valuesTmp);
+	}
+}
+
+// Returns order such that order[newId] = oldId, sorting the n points by Morton code.
+template<typename Position>
+inline std::vector<uint32_t> SpatialOrder(const size_t n, const float3 aabbMin, const float3 aabbMax, Position&& position) {
+	std::vector<uint64_t> codes(n);
+	std::vector<uint32_t> order(n);
+	ParallelFor(n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			codes[i] = MortonCode(position(i), aabbMin, aabbMax);
+			order[i] = (uint32_t)i;
+		}
+	});
+	ParallelRadixSort(codes, order);
+	return order;
+}
+
+inline std::vector<uint32_t> InvertPermutation(const std::span<const uint32_t> order) {
+	std::vector<uint32_t> inverse(order.size());
+	ParallelFor(order.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			inverse[order[i]] = (uint32_t)i;
+	});
+	return inverse;
+}
+
+// Positions of the ids of order sorted by value: the rows of the source file, in file order.
+// Equivalent to InvertPermutation when order is a permutation, but also handles orders that
+// skip source ids (tets dropped at bake time).
+inline std::vector<uint32_t> SourceRowOrder(const std::span<const uint32_t> order) {
+	std::vector<uint64_t> keys(order.begin(), order.end());
+	std::vector<uint32_t> rows(order.size());
+	ParallelFor(rows.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			rows[i] = (uint32_t)i;
+	});
+	ParallelRadixSort(keys, rows);
+	return rows;
+}
+
+// Makes an order over a subset of ids refer to the ids the subset was taken from: order[i] = subset[order[i]].
+inline void ComposeOrder(std::vector<uint32_t>& order, const std::span<const uint32_t> subset) {
+	ParallelFor(order.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			order[i] = subset[order[i]];
+	});
+}
+
+// Permutations applied to a scene at load or bake time, mapping new ids to the ids in the source file.
+// tetOrder may skip source ids if degenerate tets were dropped.
+struct SpatialReorder {
+	std::vector<uint32_t> vertexOrder;
+	std::vector<uint32_t> tetOrder;
+
+	inline bool empty() const { return tetOrder.empty(); }
+};
+
+// Sorts vertices by Morton code, remaps indices to the new vertex ids, then sorts tets by the
+// Morton code of their centroid. Tets that share vertices end up close together in memory,
+// so the vertex loads of neighbouring threads hit the same cache lines.
+// Per-tet attributes must be gathered through the returned tetOrder to stay consistent.
+inline SpatialReorder ReorderScene(std::vector<float3>& vertices, std::vector<uint4>& indices, const float3 aabbMin, const float3 aabbMax) {
+	SpatialReorder reorder;
+	reorder.vertexOrder = SpatialOrder(vertices.size(), aabbMin, aabbMax, [&](size_t i) { return vertices[i]; });
+	const std::vector<uint32_t> vertexRemap = InvertPermutation(reorder.vertexOrder);
+
+	std::vector<float3> sortedVertices(vertices.size());
+	ParallelFor(vertices.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			sortedVertices[i] = vertices[reorder.vertexOrder[i]];
+	});
+	vertices.swap(sortedVertices);
+
+	reorder.tetOrder = SpatialOrder(indices.size(), aabbMin, aabbMax, [&](size_t i) {
+		const uint4 tet = indices[i];
+		return 0.25f * (vertices[vertexRemap[tet.x]] + vertices[vertexRemap[tet.y]] + vertices[vertexRemap[tet.z]] + vertices[vertexRemap[tet.w]]);
+	});
+
+	std::vector<uint4> sortedIndices(indices.size());
+	ParallelFor(indices.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const uint4 tet = indices[reorder.tetOrder[i]];
+			sortedIndices[i] = uint4(vertexRemap[tet.x], vertexRemap[tet.y], vertexRemap[tet.z], vertexRemap[tet.w]);
+		}
+	});
+	indices.swap(sortedIndices);
+	return reorder;
+}
+
+}
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Rose/Core/CommandContext.hpp>
+
+#include "Parallel.hpp"
+#include "PlyMapping.hpp"
+
+namespace vkDelTet {
+
+using namespace RoseEngine;
+
+// Streams strided host data into device-local buffers through a fixed ring of
+// persistently mapped staging slabs.
+//
+// A background thread gathers records from the source views (faulting in the file
+// mapping as it goes) into the next free slab, while the calling thread records and
+// submits the copies of every completed slab. Disk reads, memcpy and transfers overlap,
+// and staging memory never exceeds slabSize * slabCount regardless of the scene size.
+// Slot reuse is tracked with a timeline semaphore, so streaming can also be driven
+// incrementally with Start() and Poll() without ever blocking the calling thread.
+class StagingRing {
+public:
+	// Converts srcBytes of tightly packed source records into the same number of destination records.
+	using ConvertFn = void(*)(const std::byte* src, size_t srcBytes, std::byte* dst);
+
+private:
+	struct Upload {
+		StridedView            src;
+		BufferRange<std::byte> dst;
+		std::byte*             mirror;        // optional tightly packed CPU copy of the source records, filled on the way
+		size_t                 dstRecordSize; // == src.recordSize unless converted
+		ConvertFn              convert;
+		const uint32_t*        order;         // optional: record i of dst (and mirror) is record order[i] of src
+	};
+	struct Region {
+		uint32_t upload;
+		size_t   first;
+		size_t   count;
+		size_t   stagingOffset;
+	};
+	struct Slot {
+		BufferRange<std::byte>   staging;
+		vk::raii::CommandBuffer  commandBuffer = nullptr;
+		uint64_t                 retired = 0; // timeline value signalled once the slot's last copy completes
+	};
+	// State of the streaming pass in progress, shared with the reader thread
+	struct Stream {
+		std::vector<std::vector<Region>> slabs;
+		std::mutex                       mutex;
+		std::condition_variable          cv;
+		size_t                           filled = 0, submitted = 0;
+		size_t                           totalBytes = 0;
+		bool                             afterQueueWork = false; // copies wait for earlier submissions to stop reading their destinations
+		bool                             cancelled = false;
+		std::chrono::high_resolution_clock::time_point start;
+		std::jthread                     reader; // last, so it is joined before the rest is destroyed
+
+		// Abandoning a stream (e.g. destroying a scene mid-load) stops the reader at the next slab
+		inline ~Stream() {
+			{
+				std::lock_guard lock(mutex);
+				cancelled = true;
+			}
+			cv.notify_all();
+		}
+	};
+
+	const Device*              mDevice = nullptr;
+	size_t                     mSlabSize = 0;
+	std::vector<Slot>          mSlots;
+	vk::raii::CommandPool      mCommandPool = nullptr;
+	vk::raii::Queue            mQueue = nullptr;
+	vk::raii::Semaphore        mTimeline = nullptr;
+	uint64_t                   mTimelineValue = 0; // last value a submission will signal
+	std::vector<Upload>        mUploads;
+	std::unique_ptr<Stream>    mStream;
+
+	// Splits the pending uploads into slabs of whole records
+	inline std::vector<std::vector<Region>> Plan() const {
+		std::vector<std::vector<Region>> slabs(1);
+		size_t offset = 0;
+		for (uint32_t i = 0; i < mUploads.size(); i++) {
+			const StridedView& src = mUploads[i].src;
+			const size_t recordSize = mUploads[i].dstRecordSize;
+			size_t first = 0;
+			while (first < src.count) {
+				offset = (offset + 15) & ~size_t(15);
+				size_t n = offset < mSlabSize ? std::min(src.count - first, (mSlabSize - offset) / recordSize) : 0;
+				if (n == 0) {
+					slabs.emplace_back();
+					offset = 0;
+					continue;
+				}
+				slabs.back().emplace_back(i, first, n, offset);
+				offset += n * recordSize;
+				first  += n;
+			}
+		}
+		if (slabs.back().empty())
+			slabs.pop_back();
+		return slabs;
+	}
+
+	inline static void Gather(const Upload& u, void* dst, const size_t first, const size_t n) {
+		if (u.order)
+			u.src.Gather(dst, u.order, first, n);
+		else
+			u.src.Gather(dst, first, n);
+	}
+
+	inline void Fill(const Slot& slot, const std::vector<Region>& regions) const {
+		for (const Region& r : regions) {
+			const Upload& u = mUploads[r.upload];
+			std::byte* staging = slot.staging.data() + r.stagingOffset;
+			if (u.convert) {
+				// conversion is compute bound, so it is split across the workers
+				ParallelFor(r.count, [&](size_t begin, size_t end) {
+					const size_t bytes = (end - begin) * u.src.recordSize;
+					std::vector<std::byte> scratch(u.mirror ? 0 : bytes);
+					std::byte* records = u.mirror ? u.mirror + (r.first + begin) * u.src.recordSize : scratch.data();
+					Gather(u, records, r.first + begin, end - begin);
+					u.convert(records, bytes, staging + begin * u.dstRecordSize);
+				}, 1024);
+			} else if (u.mirror) {
+				// staging memory may be write-combined, so gather into the mirror and copy that
+				std::byte* mirror = u.mirror + r.first * u.src.recordSize;
+				Gather(u, mirror, r.first, r.count);
+				std::memcpy(staging, mirror, r.count * u.src.recordSize);
+			} else
+				Gather(u, staging, r.first, r.count);
+		}
+	}
+
+public:
+	inline static StridedView AsView(const std::span<const std::byte> bytes) {
+		return StridedView{ bytes.data(), bytes.size(), 1, 1 };
+	}
+	// View of a tightly packed array with one record per element, for uploads that convert records
+	template<typename T>
+	inline static StridedView AsRecords(const std::span<const T> records) {
+		return StridedView{ reinterpret_cast<const std::byte*>(records.data()), records.size(), sizeof(T), sizeof(T) };
+	}
+
+	inline explicit operator bool() const { return !mSlots.empty(); }
+
+	inline void Create(const Device& device, const uint32_t queueFamily, const size_t slabSize = 32 << 20, const uint32_t slabCount = 4) {
+		mDevice = &device;
+		mSlabSize = slabSize;
+		mQueue = vk::raii::Queue(*device, queueFamily, 0);
+		mCommandPool = vk::raii::CommandPool(*device, vk::CommandPoolCreateInfo{
+			.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient,
+			.queueFamilyIndex = queueFamily });
+		vk::raii::CommandBuffers commandBuffers(*device, vk::CommandBufferAllocateInfo{
+			.commandPool = *mCommandPool,
+			.level = vk::CommandBufferLevel::ePrimary,
+			.commandBufferCount = slabCount });
+		const vk::SemaphoreTypeCreateInfo timelineInfo{
+			.semaphoreType = vk::SemaphoreType::eTimeline,
+			.initialValue  = 0 };
+		mTimeline = vk::raii::Semaphore(*device, vk::SemaphoreCreateInfo{ .pNext = &timelineInfo });
+		mTimelineValue = 0;
+
+		mSlots.clear();
+		for (uint32_t i = 0; i < slabCount; i++) {
+			Slot& slot = mSlots.emplace_back();
+			slot.staging = Buffer::Create(
+				device,
+				slabSize,
+				vk::BufferUsageFlagBits::eTransferSrc,
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+				VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+			slot.commandBuffer = std::move(commandBuffers[i]);
+		}
+	}
+	inline void Create(CommandContext& context) { Create(context.GetDevice(), context.QueueFamily()); }
+
+	// Queues a copy of every record in src into dst. The source (and mirror) must stay valid until Flush or Poll returns true.
+	// With order, the records are permuted on the way: dst record i is src record order[i]. src.count is
+	// then the number of records copied, so an order that skips records works on a view with a smaller count.
+	inline void Enqueue(const StridedView& src, const BufferRange<std::byte>& dst, void* mirror = nullptr, const uint32_t* order = nullptr) {
+		if (src.empty())
+			return;
+		if (src.recordSize > mSlabSize) {
+			std::cerr << "StagingRing: record of " << src.recordSize << " bytes does not fit in a slab" << std::endl;
+			return;
+		}
+		mUploads.emplace_back(src, dst, static_cast<std::byte*>(mirror), src.recordSize, nullptr, order);
+	}
+
+	// Like Enqueue, but each record is passed through convert on the host and only the
+	// converted dstRecordSize bytes are staged and copied. The mirror holds the unconverted records.
+	inline void EnqueueConverted(const StridedView& src, const size_t dstRecordSize, const BufferRange<std::byte>& dst, const ConvertFn convert, const uint32_t* order = nullptr, void* mirror = nullptr) {
+		if (src.empty())
+			return;
+		if (dstRecordSize > mSlabSize) {
+			std::cerr << "StagingRing: record of " << dstRecordSize << " bytes does not fit in a slab" << std::endl;
+			return;
+		}
+		mUploads.emplace_back(src, dst, static_cast<std::byte*>(mirror), dstRecordSize, convert, order);
+	}
+
+	inline void WaitTimeline(const uint64_t value) const {
+		const vk::Semaphore semaphore = *mTimeline;
+		(void)(**mDevice).waitSemaphores(vk::SemaphoreWaitInfo{ .semaphoreCount = 1, .pSemaphores = &semaphore, .pValues = &value }, UINT64_MAX);
+	}
+
+	// Starts streaming every queued upload. A background thread fills the slabs; the copies
+	// are only submitted by Poll(), so the queue is only ever touched by the calling thread.
+	// With afterQueueWork, each copy first waits for the work submitted before it to finish
+	// reading, for destinations that earlier frames may still use.
+	inline void Start(const bool afterQueueWork = false) {
+		if (mUploads.empty() || mStream)
+			return;
+		mStream = std::make_unique<Stream>();
+		mStream->slabs = Plan();
+		mStream->afterQueueWork = afterQueueWork;
+		mStream->start = std::chrono::high_resolution_clock::now();
+		mStream->reader = std::jthread([this, &stream = *mStream]() {
+			for (size_t i = 0; i < stream.slabs.size(); i++) {
+				Slot& slot = mSlots[i % mSlots.size()];
+				uint64_t retired;
+				{
+					std::unique_lock lock(stream.mutex);
+					stream.cv.wait(lock, [&]{ return stream.cancelled || stream.submitted + mSlots.size() > i; });
+					if (stream.cancelled)
+						return;
+					retired = slot.retired;
+				}
+				// the slot's previous slab was submitted; wait for its copy to retire before overwriting it
+				WaitTimeline(retired);
+				Fill(slot, stream.slabs[i]);
+				{
+					std::lock_guard lock(stream.mutex);
+					stream.filled = i + 1;
+				}
+				stream.cv.notify_all();
+			}
+		});
+	}
+
+	inline bool  Busy()     const { return (bool)mStream; }
+	inline float Progress() const { return mStream ? float(mStream->submitted) / float(mStream->slabs.size()) : 1.f; }
+
+	// Submits the copies of every slab filled so far. Returns true once all of them have
+	// completed on the device. With wait, blocks until that is the case.
+	inline bool Poll(const bool wait = false) {
+		if (!mStream)
+			return true;
+		Stream& stream = *mStream;
+		const size_t slotCount = mSlots.size();
+		while (stream.submitted < stream.slabs.size()) {
+			const size_t i = stream.submitted;
+			{
+				std::unique_lock lock(stream.mutex);
+				if (wait)
+					stream.cv.wait(lock, [&]{ return stream.filled > i; });
+				else if (stream.filled <= i)
+					break;
+			}
+
+			Slot& slot = mSlots[i % slotCount];
+			slot.commandBuffer.begin(vk::CommandBufferBeginInfo{ .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+			if (stream.afterQueueWork)
+				slot.commandBuffer.pipelineBarrier(
+					vk::PipelineStageFlagBits::eAllCommands,
+					vk::PipelineStageFlagBits::eTransfer,
+					{},
+					vk::MemoryBarrier{
+						.srcAccessMask = vk::AccessFlagBits::eMemoryRead,
+						.dstAccessMask = vk::AccessFlagBits::eTransferWrite },
+					{}, {});
+			for (const Region& r : stream.slabs[i]) {
+				const Upload& u = mUploads[r.upload];
+				const size_t size = r.count * u.dstRecordSize;
+				slot.commandBuffer.copyBuffer(
+					**slot.staging.mBuffer,
+					**u.dst.mBuffer,
+					vk::BufferCopy{
+						.srcOffset = slot.staging.mOffset + r.stagingOffset,
+						.dstOffset = u.dst.mOffset + r.first * u.dstRecordSize,
+						.size      = size });
+				stream.totalBytes += size;
+			}
+			slot.commandBuffer.end();
+
+			const uint64_t signalValue = ++mTimelineValue;
+			const vk::TimelineSemaphoreSubmitInfo timelineInfo{
+				.signalSemaphoreValueCount = 1,
+				.pSignalSemaphoreValues = &signalValue };
+			const vk::CommandBuffer commandBuffer = *slot.commandBuffer;
+			const vk::Semaphore     semaphore     = *mTimeline;
+			mQueue.submit(vk::SubmitInfo{
+				.pNext = &timelineInfo,
+				.commandBufferCount = 1,
+				.pCommandBuffers = &commandBuffer,
+				.signalSemaphoreCount = 1,
+				.pSignalSemaphores = &semaphore });
+			{
+				std::lock_guard lock(stream.mutex);
+				slot.retired = signalValue;
+				stream.submitted = i + 1;
+			}
+			stream.cv.notify_all();
+		}
+
+		if (stream.submitted < stream.slabs.size())
+			return false;
+		if (wait)
+			WaitTimeline(mTimelineValue);
+		else if (mTimeline.getCounterValue() < mTimelineValue)
+			return false;
+
+		stream.reader.join();
+		const auto t1 = std::chrono::high_resolution_clock::now();
+		std::cout << "Streamed " << (stream.totalBytes >> 20) << " MiB in " << stream.slabs.size() << " slabs ("
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(t1 - stream.start).count() << "ms)" << std::endl;
+		mStream.reset();
+		mUploads.clear();
+		return true;
+	}
+
+	// Copies src back to host memory through a host-cached readback buffer, one slab at a time.
+	// Blocks until done. Writes issued through other queues must have completed beforehand.
+	inline void Download(const BufferRange<std::byte>& src, std::byte* dst) {
+		if (mStream) {
+			std::cerr << "StagingRing: can't download while streaming" << std::endl;
+			return;
+		}
+		const size_t total = src.size_bytes();
+		if (total == 0)
+			return;
+		const BufferRange<std::byte> readback = Buffer::Create(
+			*mDevice,
+			std::min(mSlabSize, total),
+			vk::BufferUsageFlagBits::eTransferDst,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+		// every earlier copy has retired, so the first slot's command buffer is free
+		vk::raii::CommandBuffer& commandBuffer = mSlots[0].commandBuffer;
+		for (size_t offset = 0; offset < total; offset += readback.size()) {
+			const size_t size = std::min(readback.size(), total - offset);
+			commandBuffer.begin(vk::CommandBufferBeginInfo{ .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+			commandBuffer.copyBuffer(
+				**src.mBuffer,
+				**readback.mBuffer,
+				vk::BufferCopy{
+					.srcOffset = src.mOffset + offset,
+					.dstOffset = readback.mOffset,
+					.size      = size });
+			commandBuffer.end();
+
+			const uint64_t signalValue = ++mTimelineValue;
+			const vk::TimelineSemaphoreSubmitInfo timelineInfo{
+				.signalSemaphoreValueCount = 1,
+				.pSignalSemaphoreValues = &signalValue };
+			const vk::CommandBuffer cb        = *commandBuffer;
+			const vk::Semaphore     semaphore = *mTimeline;
+			mQueue.submit(vk::SubmitInfo{
+				.pNext = &timelineInfo,
+				.commandBufferCount = 1,
+				.pCommandBuffers = &cb,
+				.signalSemaphoreCount = 1,
+				.pSignalSemaphores = &semaphore });
+			WaitTimeline(signalValue);
+			std::memcpy(dst + offset, readback.data(), size);
+		}
+		mSlots[0].retired = mTimelineValue;
+	}
+
+	// Makes completed uploads visible to commands recorded into context afterwards.
+	inline static void RecordBarrier(CommandContext& context) {
+		context->pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eAllCommands,
+			{},
+			vk::MemoryBarrier{
+				.srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+				.dstAccessMask = vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite },
+			{}, {});
+	}
+
+	// Streams every queued upload and blocks until the copies have completed on the device.
+	// A barrier is recorded into context so later commands observe the new contents.
+	inline void Flush(CommandContext& context) {
+		if (mUploads.empty())
+			return;
+		if (mSlots.empty())
+			Create(context);
+		Start();
+		Poll(true);
+		RecordBarrier(context);
+	}
+};
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+#include <Rose/Core/RoseEngine.h>
+
+namespace vkDelTet {
+
+using namespace RoseEngine;
+
+// Load sorts tets along a Morton curve, so runs of consecutive tets are spatially compact. Each run
+// of kClusterTets tets is a cluster with a bounding sphere and AABB over its vertices, which
+// GenSpheres.cs.slang computes whenever the vertices change. The cull pass in Culling.cs.slang tests
+// the clusters against the frustum before any tet is, and lists the visible ones so renderers can
+// issue one indirect draw or dispatch per cluster.
+//
+// Degenerate tets (empty brick slots) are left out of the bounds, so a cluster of them has an empty
+// AABB and is always culled.
+static constexpr uint32_t kClusterTets = 128; // Must match CLUSTER_TETS in GenSpheres.cs.slang and Culling.cs.slang
+
+// Must match TetCluster in TetrahedronScene.slang
+struct TetCluster {
+	float4   sphere; // center, radius
+	float3   aabbMin;
+	uint32_t firstTet;
+	float3   aabbMax;
+	uint32_t tetCount;
+};
+static_assert(sizeof(TetCluster) == 48);
+
+inline uint32_t ClusterCount(const uint32_t tetCount) { return (tetCount + kClusterTets - 1) / kClusterTets; }
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cmath>
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include <Rose/Core/RoseEngine.h>
+
+#include "Parallel.hpp"
+
+namespace vkDelTet {
+
+using namespace RoseEngine;
+
+// CPU versions of the per-tet quantities computed by GenSpheres.cs.slang.
+// Keep the two in sync: baked scenes must match what the shader would produce.
+
+// Why a tet can't be drawn. Flat tets and tets with huge circumspheres get a zero sphere from
+// GenSpheres; the rest never contribute to an image.
+enum class TetDefect : uint32_t {
+	eNone,
+	eBadIndex,          // vertex index out of range
+	eNonFiniteVertex,
+	eFlat,              // |det| below epsilon
+	eHugeCircumsphere,  // radius^2 > 1e4
+	eNoDensity,         // density <= 0 or NaN
+	eCount
+};
+
+inline const char* TetDefectName(const TetDefect d) {
+	switch (d) {
+		case TetDefect::eBadIndex:         return "bad indices";
+		case TetDefect::eNonFiniteVertex:  return "non-finite vertices";
+		case TetDefect::eFlat:             return "flat";
+		case TetDefect::eHugeCircumsphere: return "huge circumspheres";
+		case TetDefect::eNoDensity:        return "no density";
+		default: return "none";
+	}
+}
+
+// Circumsphere of ABCD, or the reason GenSpheres gives the tet a zero sphere.
+inline TetDefect SolveCircumsphere(const glm::dvec3 A, const glm::dvec3 B, const glm::dvec3 C, const glm::dvec3 D, float4& sphere) {
+	const glm::dvec3 a = B - A;
+	const glm::dvec3 b = C - A;
+	const glm::dvec3 c = D - A;
+
+	const glm::dvec3 cross_bc = glm::cross(b, c);
+	const glm::dvec3 cross_ca = glm::cross(c, a);
+	const glm::dvec3 cross_ab = glm::cross(a, b);
+
+	const double denominator = 2.0 * glm::dot(a, cross_bc);
+	if (std::abs(denominator) < 1e-12)
+		return TetDefect::eFlat;
+
+	const glm::dvec3 relative_circumcenter = (glm::dot(a, a) * cross_bc + glm::dot(b, b) * cross_ca + glm::dot(c, c) * cross_ab) / denominator;
+	const double radius = glm::length(relative_circumcenter);
+	if (radius * radius > 1e4)
+		return TetDefect::eHugeCircumsphere;
+
+	sphere = float4(float3(A + relative_circumcenter), (float)radius);
+	return TetDefect::eNone;
+}
+
+inline float4 ComputeCircumsphere(const glm::dvec3 A, const glm::dvec3 B, const glm::dvec3 C, const glm::dvec3 D) {
+	float4 sphere = float4(0);
+	SolveCircumsphere(A, B, C, D, sphere);
+	return sphere;
+}
+
+inline void ComputeTetSpheres(
+	const std::span<const float3> vertices,
+	const std::span<const uint4>  indices,
+	const std::span<const float3> gradients,
+	const std::span<float4>       outputSpheres,
+	const std::span<float3>       outputCentroids,
+	const std::span<float>        outputOffsets,
+	const size_t first = 0,
+	size_t       count = ~size_t(0))
+{
+	count = std::min(count, indices.size() - first);
+	for (size_t tetId = first; tetId < first + count; tetId++) {
+		const uint4  tet = indices[tetId];
+		const float3 v0 = vertices[tet.x], v1 = vertices[tet.y], v2 = vertices[tet.z], v3 = vertices[tet.w];
+		const float4 sphere = ComputeCircumsphere(glm::dvec3(v0), glm::dvec3(v1), glm::dvec3(v2), glm::dvec3(v3));
+		outputSpheres[tetId]   = sphere;
+		outputCentroids[tetId] = 0.25f * (v0 + v1 + v2 + v3);
+		outputOffsets[tetId]   = glm::dot(gradients[tetId], v0 - float3(sphere));
+	}
+}
+
+inline TetDefect ValidateTet(const std::span<const float3> vertices, const uint4 tet, const float density) {
+	for (uint32_t k = 0; k < 4; k++)
+		if (tet[k] >= vertices.size())
+			return TetDefect::eBadIndex;
+	const float3 v[4] = { vertices[tet.x], vertices[tet.y], vertices[tet.z], vertices[tet.w] };
+	for (const float3 p : v)
+		if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+			return TetDefect::eNonFiniteVertex;
+	float4 sphere;
+	if (const TetDefect d = SolveCircumsphere(glm::dvec3(v[0]), glm::dvec3(v[1]), glm::dvec3(v[2]), glm::dvec3(v[3]), sphere); d != TetDefect::eNone)
+		return d;
+	if (!(density > 0))
+		return TetDefect::eNoDensity;
+	return TetDefect::eNone;
+}
+
+struct TetValidationReport {
+	size_t                tetCount = 0;
+	size_t                counts[(uint32_t)TetDefect::eCount] = {};
+	std::vector<uint32_t> valid; // ids of the tets without defects, ascending
+
+	inline size_t invalid() const { return tetCount - valid.size(); }
+
+	inline void Print(std::ostream& os) const {
+		os << invalid() << " of " << tetCount << " tets can't be drawn";
+		const char* separator = ": ";
+		for (uint32_t d = 1; d < (uint32_t)TetDefect::eCount; d++) {
+			if (counts[d] == 0)
+				continue;
+			os << separator << counts[d] << " " << TetDefectName((TetDefect)d);
+			separator = ", ";
+		}
+		os << std::endl;
+	}
+};
+
+// Finds the tets no renderer would draw, in parallel.
+inline TetValidationReport ValidateTets(const std::span<const float3> vertices, const std::span<const uint4> indices, const std::span<const float> densities) {
+	TetValidationReport report;
+	report.tetCount = indices.size();
+	std::vector<uint32_t> ok(indices.size());
+	std::vector<TetDefect> defects(indices.size());
+	ParallelFor(indices.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			defects[i] = ValidateTet(vertices, indices[i], densities[i]);
+			ok[i] = defects[i] == TetDefect::eNone ? 1 : 0;
+		}
+	});
+	for (const TetDefect d : defects)
+		report.counts[(uint32_t)d]++;
+
+	std::vector<uint32_t> offsets;
+	ParallelExclusiveScan(ok, offsets);
+	report.valid.resize(offsets.back());
+	ParallelFor(indices.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			if (ok[i])
+				report.valid[offsets[i]] = (uint32_t)i;
+	});
+	return report;
+}
+
+// Keeps only the tets in ids, in that order.
+inline void CompactTets(std::vector<uint4>& indices, const std::span<const uint32_t> ids) {
+	std::vector<uint4> compacted(ids.size());
+	ParallelFor(ids.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			compacted[i] = indices[ids[i]];
+	});
+	indices.swap(compacted);
+}
+
+}
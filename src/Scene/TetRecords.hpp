@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vkDelTet {
+
+// Layouts of the per-tet attributes the renderers fetch for every drawn tet. Values match
+// kTetLayout* in TetrahedronScene.slang.
+//
+// eSeparate reads indices, density, gradient, offset and the SH DC term from separate buffers,
+// so every tet touches five cache lines or more. The record layouts interleave them into one
+// aligned struct per tet (see TetrahedronScene.slang for the word layout), which PackTetRecords.cs.slang
+// fills from the separate buffers. Those stay resident as the source for edits, the CPU side and
+// the passes that only need one attribute.
+enum class TetLayout : uint32_t {
+	eSeparate = 0,
+	eRecord32 = 1, // indices, then fp16 density, gradient, offset and DC color: 32 bytes
+	eRecord48 = 2, // indices, then fp32 density, gradient, offset and DC color: 48 bytes
+};
+
+inline const char* TetLayoutName(const TetLayout l) {
+	switch (l) {
+		case TetLayout::eSeparate: return "separate";
+		case TetLayout::eRecord32: return "32 byte records";
+		case TetLayout::eRecord48: return "48 byte records";
+		default: return "unknown";
+	}
+}
+
+inline size_t TetRecordSize(const TetLayout l) {
+	switch (l) {
+		case TetLayout::eRecord32: return 32;
+		case TetLayout::eRecord48: return 48;
+		default: return 0;
+	}
+}
+
+}
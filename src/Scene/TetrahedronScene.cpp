@@ -4,223 +4,829 @@
 #include <Rose/Core/DxgiFormatConvert.h>
 #include <Rose/Core/Gui.hpp>
 #include "TetrahedronScene.hpp"
+#include "PlyScene.hpp"
+#include "PackedScene.hpp"
+#include "PlyPatch.hpp"
+#include "PlyWriter.hpp"
+#include "SceneCache.hpp"
+#include "SHCodebook.hpp"
+#include "HalfConvert.hpp"
 #include <glm/gtc/packing.hpp>
 
-// matches the value in EvaluateSH.cs.slang
-#define COEFFS_PER_BUF 16
-
 using namespace vkDelTet;
 
+static void FloatsToHalves(const std::byte* src, const size_t srcBytes, std::byte* dst) {
+	FloatToHalf(reinterpret_cast<const float*>(src), reinterpret_cast<uint16_t*>(dst), srcBytes / sizeof(float));
+}
+
+// float3 -> 4 halves, the last one zero, matching load_tet_gradient
+static void Float3sToHalf4s(const std::byte* src, const size_t srcBytes, std::byte* dst) {
+	const float* f = reinterpret_cast<const float*>(src);
+	uint16_t*    h = reinterpret_cast<uint16_t*>(dst);
+	for (size_t i = 0; i < srcBytes / sizeof(float3); i++) {
+		FloatToHalf(f + 3 * i, h + 4 * i, 3);
+		h[4 * i + 3] = 0;
+	}
+}
+
+struct TetrahedronScene::PendingLoad {
+	PlySceneSource                      ply;    // mappings the queued uploads read from
+	PackedSceneFile                     packed;
+	std::vector<uint2>                  vertices_quantized;
+	std::vector<std::vector<std::byte>> sh_quantized;
+	bool                                deriveFromVertices = false; // AABB, max density and spheres are computed once uploaded
+};
+
+struct TetrahedronScene::BrickStream {
+	// One per-tet array: its records in the mapped file and the pool buffer holding the resident bricks
+	struct Array {
+		const std::byte*       data;
+		size_t                 recordSize;
+		BufferRange<std::byte> pool;
+	};
+	// Order of arrays, the per-tet sections followed by one array per SH buffer
+	enum ArrayIndex : size_t { eIndices, eDensities, eGradients, eCircumspheres, eCentroids, eOffsets, eFirstSH };
+
+	PackedSceneFile     file;
+	std::vector<Brick>  bricks;
+	std::vector<Array>  arrays;
+	size_t              tetBytes = 0;
+	BrickResidency      residency;
+	std::vector<BrickResidency::Load> uploading; // streamed through the staging ring, committed once their copies retired
+};
+
+TetrahedronScene::TetrahedronScene() = default;
+TetrahedronScene::~TetrahedronScene() = default;
+TetrahedronScene::TetrahedronScene(TetrahedronScene&&) noexcept = default;
+TetrahedronScene& TetrahedronScene::operator=(TetrahedronScene&&) noexcept = default;
+
+void TetrahedronScene::CopyLoadSettings(const TetrahedronScene& other) {
+	sceneTranslation = other.sceneTranslation;
+	sceneRotation    = other.sceneRotation;
+	sceneScale       = other.sceneScale;
+	densityScale     = other.densityScale;
+	m_preferredPrecision      = other.m_preferredPrecision;
+	m_precision.colors        = other.m_precision.colors;
+	m_preferredSpatialReorder = other.m_preferredSpatialReorder;
+	m_preferredDropDegenerate = other.m_preferredDropDegenerate;
+	m_fitToMemory             = other.m_fitToMemory;
+	m_tetLayout               = other.m_tetLayout;
+	m_preferredStreamBricks   = other.m_preferredStreamBricks;
+	m_brickBudget             = other.m_brickBudget;
+	m_brickUploadBudget       = other.m_brickUploadBudget;
+}
+
 void TetrahedronScene::Load(CommandContext& context, const std::filesystem::path& p) {
-	if (!std::filesystem::exists(p))
+	context.GetDevice().Wait(); // wait in case previous vertices/colors/indices are in use still
+	if (!Prepare(context.GetDevice(), context.QueueFamily(), p))
 		return;
+	PollUploads(true);
+	Finalize(context);
+}
 
-	std::ifstream file;
-	file.open(p, std::ios::binary);
+bool TetrahedronScene::PollUploads(const bool wait) {
+	return m_stagingRing.Poll(wait);
+}
 
-	tinyply::PlyFile ply;
-	ply.parse_header(file);
-	const auto elements = ply.get_elements();
+bool TetrahedronScene::Prepare(const Device& device, const uint32_t queueFamily, const std::filesystem::path& p) {
+	if (!std::filesystem::exists(p))
+		return false;
+
+	if (!m_stagingRing)
+		m_stagingRing.Create(device, queueFamily);
+
+	m_bricks.reset();
+	m_poolTets = 0;
+	tetRecords = {}; // packed from the new buffers in Finalize; passes before that must read the separate ones
+	if (p.extension() == ".rmsh")
+		return m_preferredStreamBricks ? PrepareBricks(device, p) : PreparePacked(device, p);
+
+	// finish a SaveChanges that was interrupted, so the file is read as it was last saved
+	if (!RecoverPlyJournal(p))
+		return false;
+
+	auto pending = std::make_unique<PendingLoad>();
+	if (!pending->ply.Open(p))
+		return false;
+	const PlySceneViews& views = pending->ply.views;
+
+	// formats are chosen from the header counts, before anything is allocated
+	const LoadPlan plan = PlanLoad(views.positions.size(), views.indices.size(), views.numSHCoeffs,
+		m_preferredPrecision, m_fitToMemory ? DeviceMemoryBudget(device) : 0, false, TetRecordSize(m_tetLayout));
+
+	// a checkpoint that was loaded before with the same settings comes from the scene cache,
+	// skipping the reorder, SH encoding, sphere and adjacency passes
+	BakeOptions cacheOptions;
+	cacheOptions.dropDegenerate = m_preferredDropDegenerate;
+	cacheOptions.spatialReorder = m_preferredSpatialReorder;
+	cacheOptions.shFormat       = plan.precision.sh;
+	std::filesystem::path cacheEntry;
+	if (SceneCache::Get().GetSettings().enabled) {
+		if (const auto hash = SceneCache::HashFile(p)) {
+			cacheEntry = SceneCache::Get().EntryPath(*hash, cacheOptions);
+			if (SceneCache::Get().Find(cacheEntry) && PreparePacked(device, cacheEntry)) {
+				m_sourcePath     = p;
+				m_sourceTetCount = views.indices.size();
+				m_droppedTets    = m_sourceTetCount - TetCount();
+				std::cout << "Loading " << p << " from the scene cache" << std::endl;
+				return true;
+			}
+		}
+	}
 
-	auto tet_element = std::ranges::find(elements, "tetrahedron", &tinyply::PlyElement::name);
-	if (tet_element == elements.end()) {
-		std::cerr << "No vertex element in ply file." << std::endl;
-		return;
+	m_sourcePath     = p;
+	m_sourceTetCount = views.indices.size();
+	m_loadPlan       = plan;
+	m_loadPlan.Print(std::cout);
+	if (!plan.fits)
+		std::cerr << p << " may not fit in device memory even in the cheapest formats; bake it with rmvk-bake and stream bricks instead." << std::endl;
+
+	numTetSHCoeffs = views.numSHCoeffs;
+
+	const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+
+	// Validation, reordering and quantization need every position and index up front. Those are
+	// read into the mirrors first; the per-tet attributes are streamed from the file views through
+	// the staging ring, permuted on the way, and fill their mirrors as they go.
+	m_precision = plan.precision;
+	m_reorder = {};
+	views.positions.CopyTo(vertices_cpu);
+	views.indices.CopyTo(indices_cpu);
+	UpdateAABB();
+
+	{
+		const auto t0 = std::chrono::high_resolution_clock::now();
+		std::vector<float> fileDensities;
+		views.densities.CopyTo(fileDensities);
+		TetValidationReport report = ValidateTets(vertices_cpu, indices_cpu, fileDensities);
+		const auto t1 = std::chrono::high_resolution_clock::now();
+		std::cout << "Validated tets in " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << "ms: ";
+		report.Print(std::cout);
+		m_droppedTets = 0;
+		if (m_preferredDropDegenerate && report.invalid() > 0) {
+			// tetOrder keeps the ids in the file, so edits and saves still address the right rows
+			m_droppedTets = report.invalid();
+			CompactTets(indices_cpu, report.valid);
+			m_reorder.tetOrder = std::move(report.valid);
+			m_reorder.vertexOrder.resize(vertices_cpu.size());
+			std::iota(m_reorder.vertexOrder.begin(), m_reorder.vertexOrder.end(), 0u);
+		}
 	}
-	if (std::ranges::find(elements, "tetrahedron", &tinyply::PlyElement::name) == elements.end()) {
-		std::cerr << "No tetrahedron element in ply file." << std::endl;
-		return;
+	if (m_preferredSpatialReorder) {
+		const auto t0 = std::chrono::high_resolution_clock::now();
+		SpatialReorder reorder = ReorderScene(vertices_cpu, indices_cpu, minVertex, maxVertex);
+		if (!m_reorder.empty())
+			ComposeOrder(reorder.tetOrder, m_reorder.tetOrder);
+		m_reorder = std::move(reorder);
+		const auto t1 = std::chrono::high_resolution_clock::now();
+		std::cout << "Reordered scene in " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << "ms" << std::endl;
 	}
-
-	// find number of sh coeffs
-	int32_t minSH = std::numeric_limits<int32_t>::max();
-	int32_t maxSH = -1;
-	for (const auto& prop : tet_element->properties) {
-		if (!prop.name.starts_with("sh_"))
-			continue;
-		int32_t sh_i;
-		if (sscanf(prop.name.c_str(), "sh_%d", &sh_i) > 0)
-		{
-			minSH = min(minSH, sh_i);
-			maxSH = max(maxSH, sh_i);
+	const uint32_t* tetOrder = m_reorder.empty() ? nullptr : m_reorder.tetOrder.data();
+	const uint32_t numTets = (uint32_t)indices_cpu.size();
+	// with a compacting tetOrder the streamed views cover one record per kept tet, addressed through the order
+	auto perTet = [&](StridedView view) { view.count = numTets; return view; };
+
+	tetIndices       = Buffer::Create(device, numTets*sizeof(uint4), usage);
+	tetOffsets       = Buffer::Create(device, numTets*sizeof(float), vk::BufferUsageFlagBits::eStorageBuffer);
+	tetCentroids     = Buffer::Create(device, numTets*sizeof(float3), vk::BufferUsageFlagBits::eStorageBuffer);
+	tetCircumspheres = Buffer::Create(device, numTets*sizeof(float4), vk::BufferUsageFlagBits::eStorageBuffer);
+	pending->deriveFromVertices = true;
+
+	if (m_precision.vertices == VertexFormat::eUNorm21) {
+		pending->vertices_quantized = QuantizeVertices(vertices_cpu, minVertex, maxVertex);
+		vertices = Buffer::Create(device, pending->vertices_quantized.size()*sizeof(uint2), usage);
+		m_stagingRing.Enqueue(StagingRing::AsView(std::as_bytes(std::span(pending->vertices_quantized))), vertices);
+	} else {
+		vertices = Buffer::Create(device, vertices_cpu.size()*sizeof(float3), usage);
+		m_stagingRing.Enqueue(StagingRing::AsView(std::as_bytes(std::span(vertices_cpu))), vertices);
+	}
+	m_stagingRing.Enqueue(StagingRing::AsView(std::as_bytes(std::span(indices_cpu))), tetIndices.cast<std::byte>());
+	EnqueueDensitiesAndGradients(device, perTet(views.densities), perTet(views.gradients), tetOrder);
+
+	// SH is not mirrored on the CPU. It is converted to fp16 on the host while streaming,
+	// so only the bytes that stay resident are staged and copied.
+	const vk::BufferUsageFlags shUsage = usage | vk::BufferUsageFlagBits::eTransferSrc; // read back by Save
+	std::vector<std::vector<std::byte>>& sh_quantized = pending->sh_quantized;
+	sh_quantized.resize(views.sh.size());
+	tetSH.resize(views.sh.size());
+	for (uint32_t i = 0; i < views.sh.size(); i++) {
+		const StridedView sh = perTet(views.sh[i]);
+		auto fetch = [&](size_t tetId, float* rgb) { sh.Gather(rgb, tetOrder ? tetOrder[tetId] : tetId, 1); };
+		if (m_precision.sh == SHFormat::eUNorm8 || m_precision.sh == SHFormat::eCodebook) {
+			const uint32_t coeffsInBuf = (uint32_t)(sh.recordSize / sizeof(float3));
+			sh_quantized[i] = m_precision.sh == SHFormat::eUNorm8 ?
+				QuantizeSH(numTets, coeffsInBuf, COEFFS_PER_BUF, fetch) :
+				BuildSHCodebook(numTets, coeffsInBuf, COEFFS_PER_BUF, i == 0, fetch);
+			tetSH[i] = Buffer::Create(device, sh_quantized[i].size(), shUsage);
+			m_stagingRing.Enqueue(StagingRing::AsView(sh_quantized[i]), tetSH[i].cast<std::byte>());
+		} else if (m_precision.sh == SHFormat::eFloat16) {
+			tetSH[i] = Buffer::Create(device, sh.size_bytes() / 2, shUsage);
+			m_stagingRing.EnqueueConverted(sh, sh.recordSize / 2, tetSH[i].cast<std::byte>(), FloatsToHalves, tetOrder);
+		} else {
+			tetSH[i] = Buffer::Create(device, sh.size_bytes(), shUsage);
+			m_stagingRing.Enqueue(sh, tetSH[i].cast<std::byte>(), nullptr, tetOrder);
 		}
 	}
-	if (maxSH == -1) {
-		std::cerr << "No colors in ply file." << std::endl;
+
+	// rebuilt on demand by Adjacency() / VertexToTets()
+	m_adjacency    = {};
+	m_vertexToTets = {};
+	m_edits.clear();
+
+	m_pending = std::move(pending);
+	m_stagingRing.Start();
+	if (!cacheEntry.empty())
+		SceneCache::Get().Insert(p, cacheEntry, cacheOptions);
+	return true;
+}
+
+void TetrahedronScene::Finalize(CommandContext& context) {
+	if (!m_pending)
 		return;
+	if (m_bricks) {
+		// empty slots hold degenerate tets at the origin, which every renderer culls
+		for (const BufferRange<std::byte>& pool : { tetIndices.cast<std::byte>(), tetCircumspheres.cast<std::byte>(), tetDensities.GetBuffer().cast<std::byte>() })
+			context->fillBuffer(**pool.mBuffer, pool.mOffset, pool.size_bytes(), 0);
 	}
+	StagingRing::RecordBarrier(context);
+
+	if (m_pending->deriveFromVertices) {
+		UpdateAABB();
+		maxDensity = 0;
+		for (const float d : densities_cpu)
+			maxDensity = max(maxDensity, d);
+		CalculateSpheres(context);
+	}
+	m_pending.reset();
+	CalculateClusters(context);
+	PackTetRecords(context);
+}
 
-	// parse SH coefficient properties
-	std::vector<std::vector<std::string>> sh_props;
-	for (uint32_t i = minSH; i <= maxSH; i++) {
-		const auto prefix = "sh_" + std::to_string(i);
-		const uint32_t bufId = (i - minSH) / COEFFS_PER_BUF;
-		if (bufId <= sh_props.size()) sh_props.resize(bufId + 1);
-		sh_props[bufId].emplace_back(prefix + "_r");
-		sh_props[bufId].emplace_back(prefix + "_g");
-		sh_props[bufId].emplace_back(prefix + "_b");
+void TetrahedronScene::EnqueueDensitiesAndGradients(const Device& device, const StridedView& densities, const StridedView& gradients, const uint32_t* order) {
+	const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+	densities_cpu.resize(densities.size());
+	gradients_cpu.resize(gradients.size());
+
+	const BufferRange<std::byte> densityBuffer = Buffer::Create(device, densities.size() * m_precision.DensitySize(), usage | vk::BufferUsageFlagBits::eUniformTexelBuffer);
+	if (m_precision.densities == Precision::eFloat16) {
+		m_stagingRing.EnqueueConverted(densities, sizeof(uint16_t), densityBuffer, FloatsToHalves, order, densities_cpu.data());
+		tetDensities = TexelBufferView::Create(device, densityBuffer, vk::Format::eR16Sfloat);
+	} else {
+		m_stagingRing.Enqueue(densities, densityBuffer, densities_cpu.data(), order);
+		tetDensities = TexelBufferView::Create(device, densityBuffer, vk::Format::eR32Sfloat);
 	}
 
-	auto getPlyData = []<typename T>(const auto& ply_data) -> std::span<T>{
-		return std::span{reinterpret_cast<T*>(ply_data->buffer.get()), ply_data->buffer.size_bytes()/sizeof(T)};
+	tetGradients = Buffer::Create(device, gradients.size() * m_precision.GradientSize(), usage);
+	if (m_precision.gradients == Precision::eFloat16)
+		m_stagingRing.EnqueueConverted(gradients, sizeof(uint2), tetGradients, Float3sToHalf4s, order, gradients_cpu.data());
+	else
+		m_stagingRing.Enqueue(gradients, tetGradients, gradients_cpu.data(), order);
+}
+
+bool TetrahedronScene::PreparePacked(const Device& device, const std::filesystem::path& p) {
+	auto pending = std::make_unique<PendingLoad>();
+	PackedSceneFile& file = pending->packed;
+	if (!file.Open(p))
+		return false;
+	const PackedSceneHeader& header = file.Header();
+
+	const auto pos     = file.Section<float3>(PackedSectionType::eVertices);
+	const auto inds    = file.Section<uint4> (PackedSectionType::eIndices);
+	const auto dens    = file.Section<float> (PackedSectionType::eDensities);
+	const auto grad    = file.Section<float3>(PackedSectionType::eGradients);
+	const auto spheres = file.Section<float4>(PackedSectionType::eCircumspheres);
+	const auto cents   = file.Section<float3>(PackedSectionType::eCentroids);
+	const auto offs    = file.Section<float> (PackedSectionType::eOffsets);
+	if (pos.size() != header.vertexCount || inds.size() != header.tetCount || dens.size() != header.tetCount || grad.size() != header.tetCount ||
+		spheres.size() != header.tetCount || cents.size() != header.tetCount || offs.size() != header.tetCount || !file.HasSection(PackedSectionType::eSH)) {
+		std::cerr << p << " is missing sections." << std::endl;
+		return false;
+	}
+
+	// fp16 SH can be requantized further (fp32 requests load as fp16); SH baked in any other
+	// format is used as-is, since requantizing it would only compound the error
+	const SHFormat bakedSHFormat = (SHFormat)header.shFormat;
+	if (bakedSHFormat != SHFormat::eFloat16 && m_preferredPrecision.sh != bakedSHFormat)
+		std::cout << p << " has " << SHFormatName(bakedSHFormat) << " SH, ignoring the preferred SH format." << std::endl;
+	PrecisionPolicy preferred = m_preferredPrecision;
+	preferred.sh = bakedSHFormat != SHFormat::eFloat16 ? bakedSHFormat :
+		preferred.sh == SHFormat::eFloat32 ? SHFormat::eFloat16 : preferred.sh;
+	const LoadPlan plan = PlanLoad(header.vertexCount, header.tetCount, header.numSHCoeffs,
+		preferred, m_fitToMemory ? DeviceMemoryBudget(device) : 0, bakedSHFormat != SHFormat::eFloat16, TetRecordSize(m_tetLayout));
+	m_loadPlan = plan;
+	m_loadPlan.Print(std::cout);
+
+	m_sourcePath   = p;
+	m_edits.clear();
+	m_droppedTets  = 0; // a bake reports its own
+	m_sourceTetCount = 0;
+	numTetSHCoeffs = header.numSHCoeffs;
+	minVertex      = header.aabbMin;
+	maxVertex      = header.aabbMax;
+	maxDensity     = header.maxDensity;
+	m_precision    = plan.precision;
+
+	vertices_cpu .resize(pos.size());
+	indices_cpu  .resize(inds.size());
+
+	// every section but fp16 densities and gradients is already in its GPU layout, so it is streamed verbatim from the mapping
+	const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+	auto stream = [&](const auto section, void* mirror = nullptr, const vk::BufferUsageFlags extraUsage = {}) {
+		BufferRange<std::byte> buffer = Buffer::Create(device, section.size_bytes(), usage | extraUsage);
+		m_stagingRing.Enqueue(StagingRing::AsView(std::as_bytes(section)), buffer, mirror);
+		return buffer;
 	};
+	if (m_precision.vertices == VertexFormat::eUNorm21) {
+		vertices_cpu.assign(pos.begin(), pos.end());
+		pending->vertices_quantized = QuantizeVertices(pos, minVertex, maxVertex);
+		vertices = stream(std::span<const uint2>(pending->vertices_quantized));
+	} else
+		vertices = stream(pos, vertices_cpu.data());
+	tetIndices       = stream(inds, indices_cpu.data()).cast<uint4>();
+	tetCircumspheres = stream(spheres).cast<float4>();
+	tetCentroids     = stream(cents).cast<float3>();
+	tetOffsets       = stream(offs).cast<float>();
+	EnqueueDensitiesAndGradients(device, StagingRing::AsRecords(dens), StagingRing::AsRecords(grad), nullptr);
+	std::vector<std::vector<std::byte>>& sh_quantized = pending->sh_quantized;
+	tetSH.clear();
+	for (uint32_t i = 0; file.HasSection(PackedSectionType::eSH, i); i++) {
+		const auto sh = file.Section<uint16_t>(PackedSectionType::eSH, i);
+		if (m_precision.sh != bakedSHFormat) {
+			const uint32_t coeffsInBuf = (uint32_t)(sh.size() / (3 * header.tetCount));
+			auto fetch = [&](size_t tetId, float* rgb) {
+				for (uint32_t k = 0; k < coeffsInBuf * 3; k++)
+					rgb[k] = HalfToFloat(sh[tetId * coeffsInBuf * 3 + k]);
+			};
+			const std::vector<std::byte>& q = sh_quantized.emplace_back(m_precision.sh == SHFormat::eUNorm8 ?
+				QuantizeSH(header.tetCount, coeffsInBuf, COEFFS_PER_BUF, fetch) :
+				BuildSHCodebook(header.tetCount, coeffsInBuf, COEFFS_PER_BUF, i == 0, fetch));
+			tetSH.emplace_back(stream(std::span<const std::byte>(q), nullptr, vk::BufferUsageFlagBits::eTransferSrc).cast<uint32_t>());
+		} else
+			tetSH.emplace_back(stream(sh, nullptr, vk::BufferUsageFlagBits::eTransferSrc).cast<uint32_t>());
+	}
 
-	auto ply_vertices      = ply.request_properties_from_element("vertex", { "x", "y", "z" });
-	auto ply_tet_indices   = ply.request_properties_from_element("tetrahedron", { "indices" }, 4);
-	auto ply_tet_densities = ply.request_properties_from_element("tetrahedron", { "s" });
-	auto ply_tet_gradients = ply.request_properties_from_element("tetrahedron", { "grd_x", "grd_y", "grd_z" });
-	std::vector<std::shared_ptr<tinyply::PlyData>> ply_vertex_sh(sh_props.size());
-	for (uint32_t i = 0; i < sh_props.size(); i++)
-		ply_vertex_sh[i] = ply.request_properties_from_element("tetrahedron", sh_props[i]);
+	const auto adjOffsets = file.Section<uint32_t>(PackedSectionType::eAdjacencyOffsets);
+	const auto adjValues  = file.Section<uint32_t>(PackedSectionType::eAdjacency);
+	const auto v2tOffsets = file.Section<uint32_t>(PackedSectionType::eVertexTetOffsets);
+	const auto v2tValues  = file.Section<uint32_t>(PackedSectionType::eVertexTets);
+	// baked tables are used as-is; older or partial files fall back to building them on demand
+	m_adjacency    = {};
+	m_vertexToTets = {};
+	m_reorder      = {};
+	const auto vertexOrder = file.Section<uint32_t>(PackedSectionType::eVertexOrder);
+	const auto tetOrder    = file.Section<uint32_t>(PackedSectionType::eTetOrder);
+	if (vertexOrder.size() == header.vertexCount && tetOrder.size() == header.tetCount) {
+		m_reorder.vertexOrder.assign(vertexOrder.begin(), vertexOrder.end());
+		m_reorder.tetOrder   .assign(tetOrder.begin(),    tetOrder.end());
+	}
+	if (adjOffsets.size() == header.vertexCount + 1 && v2tOffsets.size() == header.vertexCount + 1) {
+		m_adjacency.offsets   .assign(adjOffsets.begin(), adjOffsets.end());
+		m_adjacency.values    .assign(adjValues.begin(),  adjValues.end());
+		m_vertexToTets.offsets.assign(v2tOffsets.begin(), v2tOffsets.end());
+		m_vertexToTets.values .assign(v2tValues.begin(),  v2tValues.end());
+	}
 
-	ply.read(file);
+	m_pending = std::move(pending);
+	m_stagingRing.Start();
+	return true;
+}
 
-	std::span pos  = getPlyData.template operator()<float3>(ply_vertices);
-	std::span inds = getPlyData.template operator()<uint4>(ply_tet_indices);
-	std::span dens = getPlyData.template operator()<float>(ply_tet_densities);
-	// std::span mask = getPlyData.template operator()<uint8_t>(ply_tet_mask);
-	std::span grad = getPlyData.template operator()<float3>(ply_tet_gradients);
+bool TetrahedronScene::PrepareBricks(const Device& device, const std::filesystem::path& p) {
+	auto stream = std::make_unique<BrickStream>();
+	PackedSceneFile& file = stream->file;
+	if (!file.Open(p, false)) // bricks are read in whatever order the camera needs them
+		return false;
+	const PackedSceneHeader& header = file.Header();
+	const SHFormat shFormat = (SHFormat)header.shFormat;
+	if (shFormat != SHFormat::eFloat16 && shFormat != SHFormat::eFloat32) {
+		// quantized SH shares block parameters or a codebook between tets, so it can't be paged per brick
+		std::cerr << p << " has " << SHFormatName(shFormat) << " SH; streaming bricks needs fp16 or fp32 SH." << std::endl;
+		return false;
+	}
 
-	const uint32_t numTets = dens.size();
+	const auto pos  = file.Section<float3>(PackedSectionType::eVertices);
+	const auto inds = file.Section<uint4> (PackedSectionType::eIndices);
+	// in BrickStream::ArrayIndex order
+	const std::pair<PackedSectionType, size_t> perTet[] = {
+		{ PackedSectionType::eIndices,       sizeof(uint4) },
+		{ PackedSectionType::eDensities,     sizeof(float) },
+		{ PackedSectionType::eGradients,     sizeof(float3) },
+		{ PackedSectionType::eCircumspheres, sizeof(float4) },
+		{ PackedSectionType::eCentroids,     sizeof(float3) },
+		{ PackedSectionType::eOffsets,       sizeof(float) } };
+	bool complete = pos.size() == header.vertexCount && file.HasSection(PackedSectionType::eSH);
+	for (const auto& [type, recordSize] : perTet)
+		complete &= file.Section<std::byte>(type).size() == header.tetCount * recordSize;
+	if (!complete) {
+		std::cerr << p << " is missing sections." << std::endl;
+		return false;
+	}
 
-	numTetSHCoeffs = 0;
-	std::vector<std::span<float3>> sh(ply_vertex_sh.size());
-	for (uint32_t i = 0; i < ply_vertex_sh.size(); i++) {
-		sh[i] = getPlyData.template operator()<float3>(ply_vertex_sh[i]);
-		numTetSHCoeffs += sh[i].size() / numTets;
+	const auto bricks = file.Section<Brick>(PackedSectionType::eBricks);
+	if (bricks.size() == (header.tetCount + kBrickTets - 1) / kBrickTets)
+		stream->bricks.assign(bricks.begin(), bricks.end());
+	else
+		stream->bricks = BuildBricks(pos, inds); // baked before brick tables; reads every index once
+	if (stream->bricks.empty()) {
+		std::cerr << p << " has no tets to stream." << std::endl;
+		return false;
 	}
 
-	minVertex = float3( FLT_MAX );
-	maxVertex = float3( FLT_MIN );
-	for (float3 p : pos) {
-		minVertex = min(p, minVertex);
-		maxVertex = max(p, maxVertex);
+	// the pool holds whole bricks of every per-tet array
+	for (const auto& [type, recordSize] : perTet)
+		stream->arrays.emplace_back(file.Section<std::byte>(type).data(), recordSize);
+	for (uint32_t i = 0; file.HasSection(PackedSectionType::eSH, i); i++)
+		stream->arrays.emplace_back(file.Section<std::byte>(PackedSectionType::eSH, i).data(), file.Section<std::byte>(PackedSectionType::eSH, i).size() / header.tetCount);
+	for (const BrickStream::Array& a : stream->arrays)
+		stream->tetBytes += a.recordSize;
+	const size_t brickBytes = stream->tetBytes * kBrickTets;
+	const size_t slotCount  = std::clamp<size_t>(m_brickBudget / brickBytes, 1, stream->bricks.size());
+	m_poolTets = (uint32_t)(slotCount * kBrickTets);
+
+	const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+	for (size_t i = 0; i < stream->arrays.size(); i++) {
+		const vk::BufferUsageFlags extraUsage = i == BrickStream::eDensities ? vk::BufferUsageFlags(vk::BufferUsageFlagBits::eUniformTexelBuffer) : vk::BufferUsageFlags{};
+		stream->arrays[i].pool = Buffer::Create(device, m_poolTets * stream->arrays[i].recordSize, usage | extraUsage);
 	}
-	maxDensity = 0;
-	for (const float d : dens)
-	maxDensity = max(maxDensity, d);
+	tetIndices       = stream->arrays[BrickStream::eIndices].pool.cast<uint4>();
+	tetGradients     = stream->arrays[BrickStream::eGradients].pool;
+	tetCircumspheres = stream->arrays[BrickStream::eCircumspheres].pool.cast<float4>();
+	tetCentroids     = stream->arrays[BrickStream::eCentroids].pool.cast<float3>();
+	tetOffsets       = stream->arrays[BrickStream::eOffsets].pool.cast<float>();
+	tetDensities     = TexelBufferView::Create(device, stream->arrays[BrickStream::eDensities].pool.cast<float>(), vk::Format::eR32Sfloat);
+	tetSH.clear();
+	for (size_t i = BrickStream::eFirstSH; i < stream->arrays.size(); i++)
+		tetSH.emplace_back(stream->arrays[i].pool.cast<uint32_t>());
+	stream->residency.Reset(stream->bricks.size(), slotCount);
+
+	m_sourcePath   = p;
+	m_edits.clear();
+	m_droppedTets  = 0;
+	m_sourceTetCount = 0;
+	numTetSHCoeffs = header.numSHCoeffs;
+	minVertex      = header.aabbMin;
+	maxVertex      = header.aabbMax;
+	maxDensity     = header.maxDensity;
+	// the pool holds the file's records verbatim, so only the vertex format is up to the policy
+	m_precision    = { m_preferredPrecision.vertices, Precision::eFloat32, Precision::eFloat32, shFormat, m_preferredPrecision.colors };
+	m_loadPlan     = {};
+	m_reorder      = {};
+	m_adjacency    = {};
+	m_vertexToTets = {};
+	// no per-tet mirrors: the per-tet data only exists in the file and the pool
+	indices_cpu  .clear();
+	densities_cpu.clear();
+	gradients_cpu.clear();
+
+	// vertices stay resident, since any brick may reference any of them
+	auto pending = std::make_unique<PendingLoad>();
+	vertices_cpu.assign(pos.begin(), pos.end());
+	const std::span<const std::byte> vertexBytes = m_precision.vertices == VertexFormat::eUNorm21 ?
+		std::as_bytes(std::span<const uint2>(pending->vertices_quantized = QuantizeVertices(pos, minVertex, maxVertex))) :
+		std::as_bytes(pos);
+	vertices = Buffer::Create(device, vertexBytes.size(), usage);
+	m_stagingRing.Enqueue(StagingRing::AsView(vertexBytes), vertices);
+
+	std::cout << "Streaming " << stream->bricks.size() << " bricks of " << p << " through " << slotCount << " slots ("
+		<< (slotCount * brickBytes >> 20) << " MiB)" << std::endl;
+	m_bricks  = std::move(stream);
+	m_pending = std::move(pending);
+	m_stagingRing.Start();
+	return true;
+}
 
-	context.GetDevice().Wait(); // wait in case previous vertices/colors/indices are in use still
+void TetrahedronScene::UpdateResidency(CommandContext& context, const float4x4& viewProjection, const float3 eye) {
+	if (!m_bricks || m_pending)
+		return;
+	BrickStream& stream = *m_bricks;
+
+	// Bricks are gathered from the mapping by the staging ring's reader thread, so page faults don't
+	// stall the render thread, and copied from its persistent slabs, which are retired by its timeline.
+	// Until every copy has completed, frames wait on the ones already submitted.
+	if (!stream.uploading.empty()) {
+		const bool done = m_stagingRing.Poll();
+		StagingRing::RecordBarrier(context);
+		if (!done)
+			return;
+		for (const BrickResidency::Load& load : stream.uploading)
+			stream.residency.Commit(load);
+		stream.uploading.clear();
+		CalculateClusters(context); // slots hold whole clusters; rebuilding all of them is one read of the indices
+	}
 
-	bool compressDensities = false;
-	bool compressSH = true;
-	vertices_cpu = std::vector<float3> (pos.begin(), pos.end());
-	densities_cpu = std::vector<float> (dens.begin(), dens.end());
-	gradients_cpu = std::vector<float3> (grad.begin(), grad.end());
-	// mask_cpu = std::vector<uint8_t> (mask.begin(), mask.end());
-	indices_cpu = std::vector<uint4> (inds.begin(), inds.end());
-	// full_indices_cpu = std::vector<uint4> (inds.begin(), inds.end());
-	//
-	// printf("Masking\n");
-	// size_t n = 0;
-	// for (size_t i=0; i<full_indices_cpu.size(); i++) {
-	// 	if (mask_cpu[i] != 0) {
-	// 		indices_cpu[n] = full_indices_cpu[i];
-	// 		n++;
-	// 	}
-	// }
-	// printf("Done\n");
-
-	vertices         = context.UploadData(pos,  vk::BufferUsageFlagBits::eStorageBuffer);
-	tetIndices       = context.UploadData(indices_cpu, vk::BufferUsageFlagBits::eStorageBuffer);
-	tetGradients     = context.UploadData(grad, vk::BufferUsageFlagBits::eStorageBuffer);
-	tetOffsets     = Buffer::Create(context.GetDevice(), numTets*sizeof(float), vk::BufferUsageFlagBits::eStorageBuffer);
-	tetCentroids     = Buffer::Create(context.GetDevice(), numTets*sizeof(float3), vk::BufferUsageFlagBits::eStorageBuffer);
-	tetCircumspheres = Buffer::Create(context.GetDevice(), numTets*sizeof(float4), vk::BufferUsageFlagBits::eStorageBuffer);
+	const size_t brickBytes = stream.tetBytes * kBrickTets;
+	const BrickResidency::Plan plan = stream.residency.Update(stream.bricks, viewProjection, eye, std::max<size_t>(1, m_brickUploadBudget / brickBytes));
 
-	{
-		Pipeline& f32tof16pipeline = *compressColorsPipeline.get(context.GetDevice(), {
-			{ "INPUT_TYPE",  "float" },
-			{ "OUTPUT_TYPE", "uint16_t" },
-			{ "COMPRESS_FN", "(uint16_t)f32tof16(i)" },
-		});
-
-		if (compressDensities)
-		{
-			tetDensities = TexelBufferView::Create(context.GetDevice(), Buffer::Create(context.GetDevice(), numTets*sizeof(uint16_t), vk::BufferUsageFlagBits::eUniformTexelBuffer|vk::BufferUsageFlagBits::eStorageBuffer), vk::Format::eR16Sfloat);
-
-			// compress densities to float16
-			ShaderParameter parameters;
-			parameters["inputData"]  = (BufferParameter)context.UploadData(dens, vk::BufferUsageFlagBits::eStorageBuffer);
-			parameters["outputData"] = (BufferParameter)tetDensities.GetBuffer();
-			parameters["count"] = numTets;
-			context.Dispatch(f32tof16pipeline, numTets, parameters);
-		}
-		else
-	{
-			tetDensities = TexelBufferView::Create(context.GetDevice(), context.UploadData(dens, vk::BufferUsageFlagBits::eUniformTexelBuffer|vk::BufferUsageFlagBits::eStorageBuffer), vk::Format::eR32Sfloat);
-		}
+	// start paging in the bricks that come next, so their copies don't stall on the disk
+	for (size_t i = 0; i < std::min(plan.prefetch.size(), plan.loads.size() + 4); i++) {
+		const Brick& brick = stream.bricks[plan.prefetch[i]];
+		for (const BrickStream::Array& a : stream.arrays)
+			stream.file.File().AdviseWillNeed(a.data + brick.firstTet * a.recordSize, brick.tetCount * a.recordSize);
+	}
+	if (plan.loads.empty())
+		return;
 
-		// sh_cpu = std::vector<float3> (grad.begin(), grad.end());
-		std::cout << std::endl << "SH Size" << sh.size() << ", " << sh[0].size() << std::endl;
-		tetSH.resize(sh.size());
-		for (uint32_t i = 0; i < sh.size(); i++)
-		{
-			if (compressSH)
-			{
-				// compress SH coefficients to float16
-				tetSH[i] = Buffer::Create(context.GetDevice(), sh[i].size()*sizeof(uint16_t)*3, vk::BufferUsageFlagBits::eStorageBuffer);
-
-				const uint32_t n = (uint32_t)(sh[i].size()*3);
-				ShaderParameter parameters;
-				parameters["inputData"]  = (BufferParameter)context.UploadData(sh[i], vk::BufferUsageFlagBits::eStorageBuffer);
-				parameters["outputData"] = (BufferParameter)tetSH[i];
-				parameters["count"] = n;
-				context.Dispatch(f32tof16pipeline, n, parameters);
-			}
-			else
-		{
-				tetSH[i] = context.UploadData(sh[i], vk::BufferUsageFlagBits::eStorageBuffer);
+	bool shortBrick = false;
+	for (const BrickResidency::Load& load : plan.loads) {
+		const Brick& brick = stream.bricks[load.brick];
+		for (const BrickStream::Array& a : stream.arrays) {
+			const size_t size = brick.tetCount * a.recordSize;
+			m_stagingRing.Enqueue(
+				StagingRing::AsView({ a.data + brick.firstTet * a.recordSize, size }),
+				a.pool.slice(load.slot * kBrickTets * a.recordSize, size));
+		}
+		shortBrick |= brick.tetCount < kBrickTets;
+	}
+	if (shortBrick) {
+		// slots being replaced may still be read by the previous frame
+		context->pipelineBarrier(
+			vk::PipelineStageFlagBits::eAllCommands,
+			vk::PipelineStageFlagBits::eTransfer,
+			{},
+			vk::MemoryBarrier{
+				.srcAccessMask = vk::AccessFlagBits::eMemoryRead,
+				.dstAccessMask = vk::AccessFlagBits::eTransferWrite },
+			{}, {});
+		// the last brick is short; the rest of its slot must hold empty tets, not those of the previous brick
+		for (const BrickResidency::Load& load : plan.loads) {
+			const Brick& brick = stream.bricks[load.brick];
+			if (brick.tetCount == kBrickTets)
+				continue;
+			for (const size_t i : { BrickStream::eIndices, BrickStream::eCircumspheres }) {
+				const BrickStream::Array& a = stream.arrays[i];
+				const size_t first = a.pool.mOffset + (load.slot * kBrickTets + brick.tetCount) * a.recordSize;
+				context->fillBuffer(**a.pool.mBuffer, first, (kBrickTets - brick.tetCount) * a.recordSize, 0);
 			}
 		}
 	}
+	m_stagingRing.Start(true);
+	m_stagingRing.Poll();
+	stream.uploading = plan.loads;
+}
 
-	CalculateSpheres(context);
+bool TetrahedronScene::Save(const std::filesystem::path& p) {
+	const uint32_t numTets = TetCount();
+	const uint32_t numVertices = VertexCount();
+	if (numTets == 0)
+		return false;
+	if (m_bricks) {
+		std::cerr << "Can't save a scene that is streamed in bricks." << std::endl;
+		return false;
+	}
+	if (m_stagingRing.Busy()) {
+		std::cerr << "Can't save while the scene is loading." << std::endl;
+		return false;
+	}
+	const auto t0 = std::chrono::high_resolution_clock::now();
+
+	// SH only lives on the GPU. The source checkpoint still has it exactly (edits never touch SH);
+	// otherwise the stripes are read back and decoded from whatever format they were loaded in.
+	// Dropped tets were never loaded, so their rows are carried over from the source as well.
+	PlySceneSource source;
+	const bool shFromSource = m_sourcePath.extension() == ".ply" && source.Open(m_sourcePath) &&
+		source.views.densities.size() == m_sourceTetCount && m_sourceTetCount == numTets + m_droppedTets &&
+		source.views.numSHCoeffs == numTetSHCoeffs && source.views.sh.size() == tetSH.size();
+	std::error_code ec;
+	const bool overwritesSource = std::filesystem::equivalent(p, m_sourcePath, ec);
+	const size_t droppedRows = shFromSource ? m_droppedTets : 0;
+	if (m_droppedTets > 0 && !shFromSource) {
+		if (overwritesSource) {
+			std::cerr << m_sourcePath << " no longer matches the loaded scene and " << m_droppedTets
+				<< " degenerate tets were dropped from it, not overwriting it. Save to another file instead." << std::endl;
+			return false;
+		}
+		std::cerr << "The source checkpoint is not readable, saving without the " << m_droppedTets << " degenerate tets dropped at load." << std::endl;
+	}
+	std::vector<std::vector<std::byte>> shData;
+	if (!shFromSource) {
+		shData.resize(tetSH.size());
+		for (uint32_t i = 0; i < tetSH.size(); i++) {
+			shData[i].resize(tetSH[i].size_bytes());
+			m_stagingRing.Download(tetSH[i].cast<std::byte>(), shData[i].data());
+		}
+	}
+	auto coeffsInBuf = [&](const uint32_t buf) { return std::min<uint32_t>(COEFFS_PER_BUF, numTetSHCoeffs - buf * COEFFS_PER_BUF); };
+	auto decodeSH = [&](const uint32_t buf, const size_t tetId, float* rgb) {
+		const uint32_t n = coeffsInBuf(buf);
+		const std::byte* data = shData[buf].data();
+		switch (m_precision.sh) {
+			case SHFormat::eFloat32:
+				std::memcpy(rgb, data + tetId * n * sizeof(float3), n * sizeof(float3));
+				break;
+			case SHFormat::eFloat16:
+				for (uint32_t k = 0; k < n * 3; k++) {
+					uint16_t h;
+					std::memcpy(&h, data + (tetId * n * 3 + k) * sizeof(uint16_t), sizeof(h));
+					rgb[k] = HalfToFloat(h);
+				}
+				break;
+			case SHFormat::eUNorm8:
+				DequantizeSH(data, numTets, tetId, n, COEFFS_PER_BUF, rgb);
+				break;
+			case SHFormat::eCodebook:
+				DecodeSHCodebook(data, numTets, tetId, n, COEFFS_PER_BUF, buf == 0, rgb);
+				break;
+		}
+	};
 
+	// Rows are written in the order of the source checkpoint, so the saved file lines up with it.
+	// Vertices added after loading have no source id and keep their own, which is past every source id.
+	// With dropped tets every source row is written, and the ones that weren't loaded map to kDroppedRow.
+	constexpr uint32_t kDroppedRow = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> tetRow;
+	if (droppedRows > 0) {
+		tetRow.assign(m_sourceTetCount, kDroppedRow);
+		for (uint32_t t = 0; t < numTets; t++)
+			tetRow[OriginalTetId(t)] = t;
+	} else
+		tetRow = SourceRowOrder(m_reorder.tetOrder);
+	const std::vector<uint32_t> vertexRow = SourceRowOrder(m_reorder.vertexOrder);
+	const size_t numTetRows = numTets + droppedRows;
+	auto tetAt    = [&](const size_t row) { return row < tetRow.size()    ? tetRow[row]    : (uint32_t)row; };
+	auto vertexAt = [&](const size_t row) { return row < vertexRow.size() ? vertexRow[row] : (uint32_t)row; };
+
+	PlyWriter writer;
+	writer.Comment("vkDelTet scene");
+	writer.Element("vertex", numVertices);
+	writer.Property(PlyType::eFloat32, "x");
+	writer.Property(PlyType::eFloat32, "y");
+	writer.Property(PlyType::eFloat32, "z");
+	writer.Element("tetrahedron", numTetRows);
+	writer.ListProperty(PlyType::eUInt8, PlyType::eUInt32, "indices");
+	writer.Property(PlyType::eFloat32, "s");
+	writer.Property(PlyType::eFloat32, "grd_x");
+	writer.Property(PlyType::eFloat32, "grd_y");
+	writer.Property(PlyType::eFloat32, "grd_z");
+	for (uint32_t i = 0; i < numTetSHCoeffs; i++)
+		for (const char* c : { "r", "g", "b" })
+			writer.Property(PlyType::eFloat32, "sh_" + std::to_string(i) + "_" + c);
+	if (!writer.Open(p))
+		return false;
+
+	writer.WriteRows(numVertices, sizeof(float3), [&](size_t first, size_t last, std::byte* dst) {
+		for (size_t row = first; row < last; row++, dst += sizeof(float3))
+			std::memcpy(dst, &vertices_cpu[vertexAt(row)], sizeof(float3));
+	});
+
+	const size_t tetRowSize = 1 + sizeof(uint4) + sizeof(float) + sizeof(float3) + numTetSHCoeffs * sizeof(float3);
+	writer.WriteRows(numTetRows, tetRowSize, [&](size_t first, size_t last, std::byte* dst) {
+		for (size_t row = first; row < last; row++, dst += tetRowSize) {
+			const uint32_t t = tetAt(row);
+			std::byte* out = dst;
+			*out = std::byte{4};
+			out += 1;
+			if (t == kDroppedRow) {
+				// vertices are written in source order, so the source indices still hold
+				const uint4  indices  = source.views.indices[row];
+				const float  density  = source.views.densities[row];
+				const float3 gradient = source.views.gradients[row];
+				std::memcpy(out, &indices,  sizeof(uint4));  out += sizeof(uint4);
+				std::memcpy(out, &density,  sizeof(float));  out += sizeof(float);
+				std::memcpy(out, &gradient, sizeof(float3)); out += sizeof(float3);
+				for (uint32_t i = 0; i < tetSH.size(); i++) {
+					source.views.sh[i].Gather(out, row, 1);
+					out += coeffsInBuf(i) * sizeof(float3);
+				}
+				continue;
+			}
+			const uint4 tet = indices_cpu[t];
+			const uint4 indices = uint4(OriginalVertexId(tet.x), OriginalVertexId(tet.y), OriginalVertexId(tet.z), OriginalVertexId(tet.w));
+			std::memcpy(out, &indices,          sizeof(uint4));  out += sizeof(uint4);
+			std::memcpy(out, &densities_cpu[t], sizeof(float));  out += sizeof(float);
+			std::memcpy(out, &gradients_cpu[t], sizeof(float3)); out += sizeof(float3);
+			for (uint32_t i = 0; i < tetSH.size(); i++) {
+				const uint32_t n = coeffsInBuf(i);
+				if (shFromSource)
+					source.views.sh[i].Gather(out, OriginalTetId(t), 1);
+				else {
+					float rgb[COEFFS_PER_BUF * 3];
+					decodeSH(i, t, rgb);
+					std::memcpy(out, rgb, n * sizeof(float3));
+				}
+				out += n * sizeof(float3);
+			}
+		}
+	});
+
+	if (!writer.Close())
+		return false;
+	if (overwritesSource)
+		m_edits.clear();
+	const auto t1 = std::chrono::high_resolution_clock::now();
+	std::cout << "Saved " << p << " in " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << "ms"
+		<< (shFromSource ? "" : " (SH read back from the GPU)") << std::endl;
+	return true;
+}
 
-	adjacency = std::vector<std::set<uint32_t>>(vertices_cpu.size());
-	for (const auto& tet : indices_cpu) {
-		uint32_t v[] = {tet.x, tet.y, tet.z, tet.w};
-		adjacency[v[0]].insert({v[1], v[2], v[3]});
-		adjacency[v[1]].insert({v[0], v[2], v[3]});
-		adjacency[v[2]].insert({v[0], v[1], v[3]});
-		adjacency[v[3]].insert({v[0], v[1], v[2]});
+bool TetrahedronScene::SaveChanges() {
+	if (m_edits.empty())
+		return true;
+	if (m_sourcePath.extension() != ".ply") {
+		std::cerr << "Only PLY scenes can be saved in place." << std::endl;
+		return false;
+	}
+	if (m_edits.structural)
+		return Save(m_sourcePath);
+
+	const auto t0 = std::chrono::high_resolution_clock::now();
+	if (!RecoverPlyJournal(m_sourcePath))
+		return false;
+	PlyMapping ply;
+	if (!ply.Open(m_sourcePath, true))
+		return Save(m_sourcePath); // ASCII, big-endian or variable-length rows
+
+	// rows of the source file, located from its header
+	const PlyElement* vertexElement = ply.FindElement("vertex");
+	const PlyElement* tetElement    = ply.FindElement("tetrahedron");
+	const PlyProperty* px = vertexElement ? vertexElement->FindProperty("x") : nullptr;
+	const PlyProperty* py = vertexElement ? vertexElement->FindProperty("y") : nullptr;
+	const PlyProperty* pz = vertexElement ? vertexElement->FindProperty("z") : nullptr;
+	const PlyProperty* ps = tetElement    ? tetElement->FindProperty("s")    : nullptr;
+	const auto isFloat = [](const PlyProperty* prop) { return prop && !prop->isList && prop->type == PlyType::eFloat32; };
+	// dropped tets still have their rows, which the loaded ones are patched around through OriginalTetId
+	if (!isFloat(px) || !isFloat(py) || !isFloat(pz) || !isFloat(ps) ||
+		vertexElement->count != VertexCount() || tetElement->count != m_sourceTetCount) {
+		std::cerr << m_sourcePath << " no longer matches the loaded scene, saving it as a whole." << std::endl;
+		ply.Close();
+		return Save(m_sourcePath);
 	}
 
-	vertex_to_tets = std::vector<std::vector<uint32_t>> (vertices_cpu.size());
-	for (uint32_t tet_idx = 0; tet_idx < indices_cpu.size(); ++tet_idx) {
-		const auto& tet = indices_cpu[tet_idx];
-		vertex_to_tets[tet.x].push_back(tet_idx);
-		vertex_to_tets[tet.y].push_back(tet_idx);
-		vertex_to_tets[tet.z].push_back(tet_idx);
-		vertex_to_tets[tet.w].push_back(tet_idx);
+	auto unique = [](std::vector<uint32_t> ids) {
+		std::ranges::sort(ids);
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+		return ids;
+	};
+	const std::vector<uint32_t> dirtyVertices = unique(m_edits.vertices);
+	const std::vector<uint32_t> dirtyTets     = unique(m_edits.tets);
+
+	std::vector<PlyPatch> patches;
+	patches.reserve(dirtyVertices.size() * 3 + dirtyTets.size());
+	auto patch = [&](const PlyElement& e, const PlyProperty& prop, const uint32_t row, const float value) {
+		PlyPatch& p = patches.emplace_back();
+		p.offset = e.offset + row * e.stride + prop.offset;
+		std::memcpy(&p.bits, &value, sizeof(float));
+	};
+	for (const uint32_t v : dirtyVertices) {
+		const uint32_t row = OriginalVertexId(v);
+		patch(*vertexElement, *px, row, vertices_cpu[v].x);
+		patch(*vertexElement, *py, row, vertices_cpu[v].y);
+		patch(*vertexElement, *pz, row, vertices_cpu[v].z);
 	}
+	for (const uint32_t t : dirtyTets)
+		patch(*tetElement, *ps, OriginalTetId(t), densities_cpu[t]);
+
+	if (!PatchPly(m_sourcePath, ply, patches))
+		return false;
+	m_edits.clear();
+	// writes through the mapping don't reliably update the modification time, which keys the scene cache
+	std::error_code ec;
+	std::filesystem::last_write_time(m_sourcePath, std::filesystem::file_time_type::clock::now(), ec);
+
+	const auto t1 = std::chrono::high_resolution_clock::now();
+	std::cout << "Patched " << dirtyVertices.size() << " vertices and " << dirtyTets.size() << " tets into " << m_sourcePath << " in "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1000.0 << "ms" << std::endl;
+	return true;
+}
 
+void TetrahedronScene::UpdateAABB() {
+	minVertex = float3( FLT_MAX );
+	maxVertex = float3(-FLT_MAX );
+	for (const float3 p : vertices_cpu) {
+		minVertex = min(p, minVertex);
+		maxVertex = max(p, maxVertex);
+	}
+}
 
-	size_t nb_verts = size_t(vertices_cpu.size());
-	std::vector<double> vertices_double(nb_verts * 3);
-	for(size_t i = 0; i < nb_verts; ++i) {
-		vertices_double[i * 3 + 0] = double(vertices_cpu[i].x);
-		vertices_double[i * 3 + 1] = double(vertices_cpu[i].y);
-		vertices_double[i * 3 + 2] = double(vertices_cpu[i].z);
+void TetrahedronScene::UploadVertices(CommandContext& context) {
+	const Device& device = context.GetDevice();
+
+	// Define the necessary usage flags for a versatile vertex buffer.
+	const vk::BufferUsageFlags usage =
+		vk::BufferUsageFlagBits::eVertexBuffer |
+		vk::BufferUsageFlagBits::eStorageBuffer |
+		vk::BufferUsageFlagBits::eTransferSrc | // For future copies
+		vk::BufferUsageFlagBits::eTransferDst;
+
+	UpdateAABB();
+	if (m_precision.vertices == VertexFormat::eUNorm21) {
+		const BufferRange<uint2> data = Buffer::Create(device, QuantizeVertices(vertices_cpu, minVertex, maxVertex), usage);
+		vertices = data.cast<std::byte>();
+	} else {
+		const BufferRange<float3> data = Buffer::Create(device, vertices_cpu, usage);
+		vertices = data.cast<std::byte>();
 	}
+}
 
-	// size_t nb_inds = size_t(full_indices_cpu.size());
-	// std::vector<size_t> indices_flat(nb_inds * 4);
-	// for(size_t i = 0; i < nb_inds; ++i) {
-	// 	indices_flat[i * 4 + 0] = size_t(full_indices_cpu[i].x);
-	// 	indices_flat[i * 4 + 1] = size_t(full_indices_cpu[i].y);
-	// 	indices_flat[i * 4 + 2] = size_t(full_indices_cpu[i].z);
-	// 	indices_flat[i * 4 + 3] = size_t(full_indices_cpu[i].w);
-	// }
-	// GEO::initialize(GEO::GEOGRAM_INSTALL_ALL);
-	// triangulation = GEO::Delaunay::create(GEO::coord_index_t(3), "BDEL");
-	// GEO::Delaunay* base_ptr = triangulation.get();
-	//
-	// // 2. Use dynamic_cast to safely cast it to the derived pointer.
-	// auto* delaunay3d_ptr = dynamic_cast<GEO::Delaunay3d*>(base_ptr);
-	// delaunay3d_ptr->set_mesh(vertices_double, indices_flat);
+const CsrTable& TetrahedronScene::VertexToTets() {
+	if (m_vertexToTets.size() != vertices_cpu.size())
+		m_vertexToTets = BuildVertexToTets(indices_cpu, (uint32_t)vertices_cpu.size());
+	return m_vertexToTets;
+}
 
+const CsrTable& TetrahedronScene::Adjacency() {
+	if (m_adjacency.size() != vertices_cpu.size())
+		m_adjacency = BuildVertexAdjacency(VertexToTets(), indices_cpu);
+	return m_adjacency;
 }
 
 ShaderParameter TetrahedronScene::GetShaderParameter() {
@@ -229,11 +835,17 @@ ShaderParameter TetrahedronScene::GetShaderParameter() {
 	sceneParams["tetDensities"] = (TexelBufferParameter)tetDensities;
 	sceneParams["tetIndices"]   = (BufferParameter)tetIndices;
 	sceneParams["tetGradients"] = (BufferParameter)tetGradients;
+	sceneParams["tetOffsets"]   = (BufferParameter)tetOffsets;
+	sceneParams["tetRecords"]   = (BufferParameter)(tetRecords ? tetRecords : tetIndices.cast<std::byte>()); // bound even when unused
+	sceneParams["tetLayout"]    = (uint32_t)GetTetLayout();
 	sceneParams["aabbMin"]      = minVertex;
 	sceneParams["aabbMax"]      = maxVertex;
 	sceneParams["densityScale"] = densityScale;
 	sceneParams["numTets"]      = TetCount();
-	sceneParams["numVertices"]  = (uint32_t)vertices.size();
+	sceneParams["numVertices"]  = VertexCount();
+	sceneParams["vertexFormat"] = (uint32_t)m_precision.vertices;
+	sceneParams["gradientFormat"] = (uint32_t)m_precision.gradients;
+	sceneParams["colorFormat"]    = (uint32_t)m_precision.colors;
 	return sceneParams;
 }
 
@@ -243,7 +855,7 @@ void TetrahedronScene::DrawGui(CommandContext& context) {
 		ImGui::Text("%0.2f%s tetrahedra", x, unit);
 	}
 	{
-		const auto[x, unit] = FormatNumber(vertices.size());
+		const auto[x, unit] = FormatNumber(VertexCount());
 		ImGui::Text("%0.2f%s vertices", x, unit);
 	}
 	{	
@@ -261,6 +873,119 @@ void TetrahedronScene::DrawGui(CommandContext& context) {
 	if (vertices)
 		ImGui::Text("SH coeffs: %u", numTetSHCoeffs);
 
+	if (vertices && ImGui::BeginCombo("SH format", SHFormatName(m_precision.sh))) {
+		for (const SHFormat f : { SHFormat::eFloat32, SHFormat::eFloat16, SHFormat::eUNorm8, SHFormat::eCodebook }) {
+			if (ImGui::Selectable(SHFormatName(f), f == m_precision.sh) && f != m_precision.sh) {
+				// SH only lives on the GPU, so changing its format reloads the scene
+				m_preferredPrecision.sh = f;
+				m_reloadRequested = true;
+			}
+		}
+		ImGui::EndCombo();
+	}
+
+	if (vertices && ImGui::BeginCombo("Vertex format", VertexFormatName(m_precision.vertices))) {
+		for (const VertexFormat f : { VertexFormat::eFloat32, VertexFormat::eUNorm21 }) {
+			if (ImGui::Selectable(VertexFormatName(f), f == m_precision.vertices) && f != m_precision.vertices) {
+				m_preferredPrecision.vertices = f;
+				m_reloadRequested = true;
+			}
+		}
+		ImGui::EndCombo();
+	}
+	// densities and gradients are converted while loading
+	auto precisionCombo = [&](const char* label, Precision& preferred, const Precision current) {
+		if (!ImGui::BeginCombo(label, PrecisionName(current)))
+			return;
+		for (const Precision f : { Precision::eFloat32, Precision::eFloat16 }) {
+			if (ImGui::Selectable(PrecisionName(f), f == current) && f != current) {
+				preferred = f;
+				m_reloadRequested = true;
+			}
+		}
+		ImGui::EndCombo();
+	};
+	if (vertices && !m_bricks) {
+		precisionCombo("Density format",  m_preferredPrecision.densities, m_precision.densities);
+		precisionCombo("Gradient format", m_preferredPrecision.gradients, m_precision.gradients);
+	}
+	// evaluated colors are rewritten every frame, so they switch right away
+	if (vertices && ImGui::BeginCombo("Color format", ColorFormatName(m_precision.colors))) {
+		for (const ColorFormat f : { ColorFormat::eFloat32, ColorFormat::eFloat16, ColorFormat::eSharedExp })
+			if (ImGui::Selectable(ColorFormatName(f), f == m_precision.colors))
+				m_preferredPrecision.colors = m_precision.colors = f;
+		ImGui::EndCombo();
+	}
+	if (vertices && !m_bricks && ImGui::BeginCombo("Tet layout", TetLayoutName(GetTetLayout()))) {
+		for (const TetLayout l : { TetLayout::eSeparate, TetLayout::eRecord32, TetLayout::eRecord48 })
+			if (ImGui::Selectable(TetLayoutName(l), l == GetTetLayout()) && l != GetTetLayout())
+				SetTetLayout(context, l);
+		ImGui::EndCombo();
+	}
+	// packed scenes are reordered when they are baked
+	if (vertices && m_sourcePath.extension() == ".ply" && ImGui::Checkbox("Spatial reorder", &m_preferredSpatialReorder))
+		m_reloadRequested = true;
+	if (m_sourcePath.extension() == ".ply" && ImGui::TreeNode("Scene cache")) {
+		SceneCache& cache = SceneCache::Get();
+		SceneCache::Settings& settings = cache.GetSettings();
+		ImGui::Checkbox("Enabled", &settings.enabled);
+		int limitGiB = (int)(settings.maxBytes >> 30);
+		if (ImGui::DragInt("Size limit (GiB)", &limitGiB, 1, 1, 1024))
+			settings.maxBytes = size_t(limitGiB) << 30;
+		const auto[x, unit] = FormatBytes(cache.Size());
+		ImGui::Text("%lu%s in %s", x, unit, cache.Directory().string().c_str());
+		if (ImGui::Button("Evict"))
+			cache.Evict();
+		ImGui::SameLine();
+		if (ImGui::Button("Clear"))
+			cache.Clear();
+		ImGui::TreePop();
+	}
+	if (m_sourcePath.extension() == ".rmsh") {
+		bool changed = ImGui::Checkbox("Stream bricks", &m_preferredStreamBricks);
+		if (m_preferredStreamBricks) {
+			int budgetMiB = (int)(m_brickBudget >> 20);
+			if (ImGui::DragInt("Brick budget (MiB)", &budgetMiB, 16, 64, 1 << 20))
+				m_brickBudget = size_t(budgetMiB) << 20;
+			changed |= ImGui::IsItemDeactivatedAfterEdit(); // reload once dragging ends
+		}
+		if (m_bricks)
+			ImGui::Text("%zu / %zu bricks resident", m_bricks->residency.ResidentCount(), m_bricks->bricks.size());
+		// the pool size is the tet count while streaming, so the render buffers are resized with the reload
+		m_reloadRequested |= changed;
+	}
+	// dropping tets changes the tet count, so the render buffers are resized with the reload
+	if (vertices && m_sourcePath.extension() == ".ply" && ImGui::Checkbox("Drop degenerate tets", &m_preferredDropDegenerate))
+		m_reloadRequested = true;
+	if (m_droppedTets > 0)
+		ImGui::Text("%zu degenerate tets dropped", m_droppedTets);
+	if (vertices && !m_bricks) {
+		if (ImGui::Checkbox("Fit to GPU memory", &m_fitToMemory))
+			m_reloadRequested = true;
+		if (m_loadPlan.budgetBytes > 0)
+			ImGui::Text("Planned %zu + %zu MiB of %zu MiB%s", m_loadPlan.sceneBytes >> 20, m_loadPlan.scratchBytes >> 20, m_loadPlan.budgetBytes >> 20, m_loadPlan.fits ? "" : " (does not fit)");
+	}
+	if (m_precision.vertices == VertexFormat::eUNorm21) {
+		const float3 e = MaxVertexError();
+		ImGui::Text("Max vertex error: %.2e %.2e %.2e", e.x, e.y, e.z);
+	}
+
+	if (m_sourcePath.extension() == ".ply" && HasUnsavedChanges() && ImGui::Button("Save changes"))
+		SaveChanges();
+	if (vertices && ImGui::Button("Save scene")) {
+		const std::filesystem::path dst = pfd::save_file("Save scene", m_sourcePath.string(), { "PLY files (.ply)", "*.ply" }).result();
+		if (!dst.empty())
+			Save(dst);
+	}
+	if (m_sourcePath.extension() == ".ply") {
+		// baked on the scene cache's worker, so the GUI keeps running
+		const std::filesystem::path dst = std::filesystem::path(m_sourcePath).replace_extension(".rmsh");
+		if (SceneCache::Get().Baking(dst))
+			ImGui::TextUnformatted("Exporting packed scene...");
+		else if (ImGui::Button("Export packed scene"))
+			SceneCache::Get().Export(m_sourcePath, dst);
+	}
+
 	ImGui::Separator();
 	ImGui::DragFloat3("Translation", &sceneTranslation.x, 0.1f);
 	ImGui::DragFloat3("Rotation", &sceneRotation.x, 0, -float(M_PI), float(M_PI));
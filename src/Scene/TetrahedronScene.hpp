@@ -4,11 +4,23 @@
 #include <stack>
 #include <vector>
 #include <filesystem>
+#include <memory>
 #include <utility>
 
 #include <Rose/Core/CommandContext.hpp>
 #include <Rose/Core/PipelineCache.hpp>
 #include <Rose/Scene/Mesh.hpp>
+
+#include "BrickStreaming.hpp"
+#include "Csr.hpp"
+#include "LoadPlanner.hpp"
+#include "PrecisionPolicy.hpp"
+#include "SHQuantize.hpp"
+#include "SpatialSort.hpp"
+#include "StagingRing.hpp"
+#include "TetClusters.hpp"
+#include "TetRecords.hpp"
+#include "VertexQuantize.hpp"
 // #include <geogram/delaunay/delaunay_3d.h>
 // #include <geogram/delaunay/delaunay.h>
 // #include <geogram/basic/logger.h>
@@ -42,8 +54,6 @@ public:
 	std::vector<uint8_t>				   mask_cpu;
     std::vector<float>                 densities_cpu;
     std::vector<float3>                gradients_cpu;
-	std::vector<std::set<uint32_t>>	   adjacency;
-	std::vector<std::vector<uint32_t>> vertex_to_tets;
 
 	// GEO::Delaunay_var triangulation;
 
@@ -53,21 +63,66 @@ public:
     float3 sceneRotation    = float3(M_PI/2, 0, 0);
     
     inline const BufferRange<float4>& TetCircumspheres() const { return tetCircumspheres; }
+    inline const BufferRange<TetCluster>& TetClusters() const { return tetClusters; } // see TetClusters.hpp
+    inline uint32_t ClusterCount() const { return vkDelTet::ClusterCount(TetCount()); }
     inline const BufferRange<float3>& TetCentroids() const { return tetCentroids; }
     inline const BufferRange<float>& TetOffsets() const { return tetOffsets; } 
     inline const auto& TetSH() const { return tetSH; }
     inline float    MaxDensity() const { return maxDensity; }
     inline float    DensityScale() const { return densityScale; } 
-    inline uint32_t TetCount()    const { return (uint32_t)indices_cpu.size(); }
+    inline uint32_t TetCount()    const { return m_poolTets ? m_poolTets : (uint32_t)indices_cpu.size(); } // brick pool size when streaming
     inline uint32_t VertexCount() const { return (uint32_t)vertices_cpu.size(); }
     inline uint32_t NumSHCoeffs() const { return numTetSHCoeffs; } 
+    // Formats the scene is stored in, and the ones the next Load will use (subject to SetFitToMemory).
+    // Evaluated colors are produced every frame, so their precision applies right away.
+    inline const PrecisionPolicy& GetPrecision() const { return m_precision; }
+    inline const PrecisionPolicy& GetPreferredPrecision() const { return m_preferredPrecision; }
+    inline void     SetPrecision(const PrecisionPolicy& p) { m_preferredPrecision = p; m_precision.colors = p.colors; } // applied by the next Load
+    inline SHFormat GetSHFormat() const { return m_precision.sh; }
+    inline void     SetSHFormat(const SHFormat f) { m_preferredPrecision.sh = f; } // applied by the next Load
+    inline VertexFormat GetVertexFormat() const { return m_precision.vertices; }
+    // Interleaved tet records are packed from the resident buffers, so the layout applies right away.
+    // Streamed bricks always use the separate layout.
+    inline TetLayout    GetTetLayout() const { return tetRecords ? m_tetLayout : TetLayout::eSeparate; }
+    void                SetTetLayout(CommandContext& context, const TetLayout layout);
+    inline void         SetVertexFormat(const VertexFormat f) { m_preferredPrecision.vertices = f; } // applied by the next Load
+    inline bool         GetSpatialReorder() const { return !m_reorder.empty(); }
+    inline void         SetSpatialReorder(const bool enable) { m_preferredSpatialReorder = enable; } // applied by the next Load
+    // Load drops tets no renderer would draw (see ValidateTets) from every per-tet array.
+    inline void         SetDropDegenerate(const bool enable) { m_preferredDropDegenerate = enable; } // applied by the next Load
+    inline size_t       DroppedTetCount() const { return m_droppedTets; }
+    // Out-of-core mode for packed scenes: only a budget of spatial bricks is resident on the GPU, paged in
+    // from the mapped file by UpdateResidency. Tet ids are then slots of the brick pool, and the scene is read-only.
+    inline void         SetStreamBricks(const bool enable, const size_t budgetBytes) { m_preferredStreamBricks = enable; m_brickBudget = budgetBytes; } // applied by the next Load
+    inline bool         IsStreamingBricks() const { return m_bricks != nullptr; }
+    // Load falls back to cheaper formats than the preferred ones when the scene would not fit in device memory.
+    inline void         SetFitToMemory(const bool enable) { m_fitToMemory = enable; } // applied by the next Load
+    inline const LoadPlan& GetLoadPlan() const { return m_loadPlan; }
+    // DrawGui only changes the load preferences and requests a reload; the owner performs it off the
+    // render thread (DelaunayTetRenderer::LoadSceneAsync), so the render buffers are resized with the scene.
+    inline bool         TakeReloadRequest() { return std::exchange(m_reloadRequested, false); }
+    inline const std::filesystem::path& SourcePath() const { return m_sourcePath; }
+    // Load sorts vertices and tets along a Morton curve and may drop degenerate tets. These map the
+    // ids used by this class (and the GPU buffers) back to the ids in the source file.
+    inline uint32_t     OriginalVertexId(const uint32_t i) const { return i < m_reorder.vertexOrder.size() ? m_reorder.vertexOrder[i] : i; }
+    inline uint32_t     OriginalTetId   (const uint32_t i) const { return i < m_reorder.tetOrder.size()    ? m_reorder.tetOrder[i]    : i; }
+    inline const SpatialReorder& Reorder() const { return m_reorder; }
+    // Bound on the per-axis difference between load_vertex() and vertices_cpu
+    inline float3       MaxVertexError() const { return m_precision.vertices == VertexFormat::eUNorm21 ? VertexQuantizationError(minVertex, maxVertex) : float3(0); }
+    // Fraction of the queued uploads submitted so far, while a load is in progress
+    inline float        LoadProgress() const { return m_stagingRing.Progress(); }
     inline float4x4 Transform()   const { return glm::translate(sceneTranslation) * glm::toMat4(glm::quat(sceneRotation)) * glm::scale(float3(sceneScale)); }
     
     // GPU buffer accessors for rendering
-    inline const BufferRange<float3>& GetVerticesGpu() const { return vertices; }
+    inline const BufferRange<std::byte>& GetVerticesGpu() const { return vertices; } // layout depends on GetVertexFormat()
     inline const BufferRange<uint4>&  GetIndicesGpu()  const { return tetIndices; }
     // (Add other GPU buffer accessors as needed by your renderers)
 
+    // Topology for the editing gizmos. Built in parallel the first time they are
+    // requested, so scenes that are only viewed never pay for them.
+    const CsrTable& Adjacency();
+    const CsrTable& VertexToTets();
+
 
     // --- DYNAMIC MODIFICATION API ---
 
@@ -82,40 +137,110 @@ public:
     // void AddTetrahedra(CommandContext& context, const std::vector<uint4>& new_indices, const std::vector<TetrahedronAttributes>& new_attributes);
 
     // --- LIFECYCLE & UTILITY ---
+    TetrahedronScene();
+    ~TetrahedronScene();
+    TetrahedronScene(TetrahedronScene&&) noexcept;
+    TetrahedronScene& operator=(TetrahedronScene&&) noexcept;
+
     void Load(CommandContext& context, const std::filesystem::path& p);
-    void Save(const std::filesystem::path& p) const;
+    // Load, split into phases so that everything but Finalize can run off the render thread:
+    //  Prepare     reads, reorders and converts the scene and queues its uploads. Records no commands.
+    //  PollUploads submits the queued copies as their slabs fill and returns true once all completed.
+    //              Must be called from the thread that submits the render queue.
+    //  Finalize    records the barrier and the GPU-derived data (circumspheres) into context.
+    bool Prepare(const Device& device, const uint32_t queueFamily, const std::filesystem::path& p);
+    bool PollUploads(const bool wait = false);
+    void Finalize(CommandContext& context);
+    // Pages bricks in and out of the pool for a camera at eye (scene space). Records the copies into context.
+    void UpdateResidency(CommandContext& context, const float4x4& viewProjection, const float3 eye);
+    // Carries transform, density scale and load preferences over to a scene that is about to replace this one
+    void CopyLoadSettings(const TetrahedronScene& other);
+    // Writes the scene, including edits, as a binary PLY in the layout Load reads, in source checkpoint order.
+    bool Save(const std::filesystem::path& p);
+    // Writes only the vertices and densities edited since the last load or save into the source PLY, in place.
+    // Falls back to Save when the edits can't be patched (added vertices, non-binary source).
+    bool SaveChanges();
+    inline bool HasUnsavedChanges() const { return !m_edits.empty(); }
     void DrawGui(CommandContext& context);
     ShaderParameter GetShaderParameter();
 	void CalculateSpheres(CommandContext& context);
+	// Recomputes the cluster bounds from the resident vertices and indices.
+	void CalculateClusters(CommandContext& context);
 
 private:
     // --- GPU-SIDE "RENDERING CACHE" DATA ---
     // These are considered implementation details and are managed internally.
     PipelineCache createSpheresPipeline  = PipelineCache(FindShaderPath("GenSpheres.cs.slang"));
-    PipelineCache compressColorsPipeline = PipelineCache(FindShaderPath("Compression.cs.slang"));
+    PipelineCache packRecordsPipeline    = PipelineCache(FindShaderPath("PackTetRecords.cs.slang"));
+    PipelineCache createClustersPipeline = PipelineCache(FindShaderPath("GenSpheres.cs.slang"), "genClusters");
     
-    BufferRange<float3> vertices;
+    BufferRange<std::byte> vertices;
     BufferRange<uint4>  tetIndices;
-    // Density Buffers
-    TexelBufferView     tetDensities;
-    BufferRange<uint16_t> tetDensities_underlyingBuffer_u16;
-    BufferRange<float>  tetDensities_underlyingBuffer_f32;
+    TexelBufferView     tetDensities; // R32Sfloat or R16Sfloat, per m_precision.densities
     // Other Attribute Buffers
-    BufferRange<float3> tetGradients;
+    BufferRange<std::byte> tetGradients; // layout depends on m_precision.gradients
     BufferRange<float4> tetCircumspheres;
+    BufferRange<TetCluster> tetClusters;
     BufferRange<float3> tetCentroids;
     BufferRange<float>  tetOffsets;
     std::vector<BufferRange<uint32_t>> tetSH; // Striped SH data
+    BufferRange<std::byte> tetRecords; // interleaved copy of the above in m_tetLayout, if not separate
 
     // --- PRIVATE STATE ---
-    bool   m_densitiesAreCompressed = false;
     float  sceneScale   = 1.f;
     float  densityScale = 1.f;
     float3 minVertex, maxVertex;
     float  maxDensity   = 0.f;
     uint32_t numTetSHCoeffs = 0;
+    std::filesystem::path m_sourcePath;
+    PrecisionPolicy m_precision;                             // formats of the GPU buffers
+    PrecisionPolicy m_preferredPrecision = kDefaultPrecision;
+    TetLayout       m_tetLayout = TetLayout::eSeparate;
+    bool           m_preferredSpatialReorder = true;
+    bool           m_preferredDropDegenerate = true;
+    bool           m_fitToMemory = true;
+    LoadPlan       m_loadPlan; // formats the last Load chose, and why
+    bool           m_reloadRequested = false;
+    size_t         m_droppedTets = 0;
+    size_t         m_sourceTetCount = 0; // tet rows in the source PLY, dropped ones included
+    SpatialReorder m_reorder; // empty if the scene is in file order
+    StagingRing m_stagingRing; // reused by every load
+    struct PendingLoad;
+    std::unique_ptr<PendingLoad> m_pending; // sources of the uploads in flight, kept alive until Finalize
+    bool   m_preferredStreamBricks = false;
+    size_t m_brickBudget       = size_t(2) << 30; // bytes of per-tet data kept resident
+    size_t m_brickUploadBudget = size_t(64) << 20; // bytes paged in per frame
+    uint32_t m_poolTets = 0; // tets in the brick pool, 0 unless streaming
+    struct BrickStream;
+    std::unique_ptr<BrickStream> m_bricks;
+    CsrTable m_adjacency;
+    CsrTable m_vertexToTets;
+
+    // IDs edited since the last load or save, patched into the source file by SaveChanges()
+    struct EditJournal {
+        std::vector<uint32_t> vertices;
+        std::vector<uint32_t> tets;
+        bool                  structural = false; // element counts changed, so rows can't be patched in place
+
+        inline bool empty() const { return vertices.empty() && tets.empty() && !structural; }
+        inline void clear() { *this = {}; }
+    };
+    EditJournal m_edits;
 
 private:
+    // Prepares a .rmsh scene written by BakePackedScene.
+    bool PreparePacked(const Device& device, const std::filesystem::path& p);
+    // Prepares a .rmsh scene for out-of-core rendering: vertices are resident, per-tet data goes through the brick pool.
+    bool PrepareBricks(const Device& device, const std::filesystem::path& p);
+    // Allocates the density and gradient buffers in m_precision and queues their uploads from fp32
+    // records, filling densities_cpu and gradients_cpu on the way.
+    void EnqueueDensitiesAndGradients(const Device& device, const StridedView& densities, const StridedView& gradients, const uint32_t* order);
+    // Packs tetRecords from the separate buffers. Called after anything they hold changes.
+    void PackTetRecords(CommandContext& context);
+    // Recomputes the AABB from vertices_cpu and re-creates the vertex buffer in m_precision.vertices.
+    void UploadVertices(CommandContext& context);
+    void UpdateAABB();
+
     // --- PRIVATE HELPERS ---
     /**
      * @brief Generic helper to update a GPU buffer with sparse data from the CPU.
@@ -173,60 +298,76 @@ inline void TetrahedronScene::AddVertices(
     const std::vector<float3>& new_vertices)
 {
 	// TODO: If this becomes a bottleneck, oversize the vertex buffer and keep track of the size manually
-    if (new_vertices.empty()) {
+    if (new_vertices.empty() || m_bricks) {
         return;
     }
 
     // --- 1. Update the CPU "source of truth" vector ---
     // This part is correct and remains the same.
     vertices_cpu.insert(vertices_cpu.end(), new_vertices.begin(), new_vertices.end());
-
-    const Device& device = context.GetDevice();
+    m_edits.structural = true;
 
     // --- 2. Re-create the entire GPU buffer from the updated CPU vector ---
     // This single pattern handles both the initial creation (from an empty state)
-    // and reallocations safely and correctly.
-
-    // Define the necessary usage flags for a versatile vertex buffer.
-    const vk::BufferUsageFlags usage =
-        vk::BufferUsageFlagBits::eVertexBuffer |
-        vk::BufferUsageFlagBits::eStorageBuffer |
-        vk::BufferUsageFlagBits::eTransferSrc | // For future copies
-        vk::BufferUsageFlagBits::eTransferDst;
-
-    // Your engine's Buffer::Create that takes a vector handles the entire
-    // staging buffer process (create, map, memcpy, copy command) for you.
-    // We create a brand new buffer with the complete, updated data.
-    vertices = Buffer::Create(device, vertices_cpu, usage);
+    // and reallocations safely and correctly. New vertices may grow the AABB,
+    // so quantized positions are re-encoded as a whole.
+    UploadVertices(context);
 }
 
 inline void TetrahedronScene::UpdateVertices(CommandContext& context, const std::vector<std::pair<uint32_t, float3>>& updates) {
+    if (m_bricks)
+        return; // bricks are re-read from the file, so streamed scenes are read-only
     for (const auto& [index, position] : updates) {
         if (index < vertices_cpu.size()) {
             vertices_cpu[index] = position;
+            m_edits.vertices.push_back(index);
         }
     }
-    UpdateBufferSparse<float3>(context, vertices, updates);
+    if (m_precision.vertices == VertexFormat::eUNorm21) {
+        // positions are encoded relative to the AABB; a vertex leaving it re-encodes the whole buffer
+        const bool inside = std::ranges::all_of(updates, [&](const auto& u) {
+            return all(greaterThanEqual(u.second, minVertex)) && all(lessThanEqual(u.second, maxVertex));
+        });
+        if (inside) {
+            std::vector<std::pair<uint32_t, uint2>> quantized;
+            quantized.reserve(updates.size());
+            for (const auto& [index, position] : updates)
+                quantized.emplace_back(index, QuantizeVertex(position, minVertex, maxVertex));
+            BufferRange<uint2> dst = vertices.cast<uint2>();
+            UpdateBufferSparse<uint2>(context, dst, quantized);
+        } else
+            UploadVertices(context);
+    } else {
+        BufferRange<float3> dst = vertices.cast<float3>();
+        UpdateBufferSparse<float3>(context, dst, updates);
+    }
 	CalculateSpheres(context);
+	CalculateClusters(context);
+	PackTetRecords(context);
 }
 
 inline void TetrahedronScene::UpdateTetDensities(CommandContext& context, const std::vector<std::pair<uint32_t, float>>& updates) {
+    if (m_bricks)
+        return;
     for (const auto& [index, density] : updates) {
         if (index < densities_cpu.size()) {
             densities_cpu[index] = density;
+            m_edits.tets.push_back(index);
         }
     }
     
-    if (m_densitiesAreCompressed) {
-        // std::vector<std::pair<uint32_t, uint16_t>> half_updates;
-        // half_updates.reserve(updates.size());
-        // for (const auto& [index, density_float] : updates) {
-        //     half_updates.push_back({index, glm::packHalf(glm::vec1(density_float))});
-        // }
-        // UpdateBufferSparse<uint16_t>(context, tetDensities_underlyingBuffer_u16, half_updates);
+    if (m_precision.densities == Precision::eFloat16) {
+        std::vector<std::pair<uint32_t, uint16_t>> half_updates;
+        half_updates.reserve(updates.size());
+        for (const auto& [index, density] : updates)
+            half_updates.emplace_back(index, FloatToHalf(density));
+        BufferRange<uint16_t> dst = tetDensities.GetBuffer().cast<uint16_t>();
+        UpdateBufferSparse<uint16_t>(context, dst, half_updates);
     } else {
-        UpdateBufferSparse<float>(context, tetDensities_underlyingBuffer_f32, updates);
+        BufferRange<float> dst = tetDensities.GetBuffer().cast<float>();
+        UpdateBufferSparse<float>(context, dst, updates);
     }
+    PackTetRecords(context);
 }
 
 inline void TetrahedronScene::RemoveTetrahedra(CommandContext& context, const std::vector<uint32_t>& tet_ids_to_remove) {
@@ -250,6 +391,45 @@ inline void TetrahedronScene::CalculateSpheres(CommandContext& context) {
 	context.Dispatch(*createSpheresPipeline.get(context.GetDevice()), (uint32_t)tetCircumspheres.size(), parameters);
 }
 
+inline void TetrahedronScene::CalculateClusters(CommandContext& context) {
+	if (TetCount() == 0) {
+		tetClusters = {};
+		return;
+	}
+	if (!tetClusters || tetClusters.size() != ClusterCount())
+		tetClusters = Buffer::Create(context.GetDevice(), ClusterCount()*sizeof(TetCluster), vk::BufferUsageFlagBits::eStorageBuffer);
+	ShaderParameter parameters = {};
+	parameters["scene"] = GetShaderParameter();
+	parameters["outputClusters"] = (BufferParameter)tetClusters;
+	context.Dispatch(*createClustersPipeline.get(context.GetDevice()), ClusterCount() * kClusterTets, parameters);
+}
+
+inline void TetrahedronScene::PackTetRecords(CommandContext& context) {
+	if (m_tetLayout == TetLayout::eSeparate || m_bricks || TetCount() == 0) {
+		tetRecords = {};
+		return;
+	}
+	const size_t recordBytes = TetCount() * TetRecordSize(m_tetLayout);
+	if (!tetRecords || tetRecords.size_bytes() != recordBytes)
+		tetRecords = Buffer::Create(context.GetDevice(), recordBytes, vk::BufferUsageFlagBits::eStorageBuffer);
+
+	ShaderParameter parameters = {};
+	parameters["scene"] = GetShaderParameter();
+	parameters["scene"]["tetLayout"] = (uint32_t)TetLayout::eSeparate; // read from the separate buffers
+	parameters["shCoeffs"][0] = (BufferParameter)(tetSH.empty() ? tetOffsets.cast<uint32_t>() : tetSH[0]); // bound even without SH
+	parameters["outputRecords"] = (BufferParameter)tetRecords;
+	parameters["tetLayout"] = (uint32_t)m_tetLayout;
+	context.Dispatch(*packRecordsPipeline.get(context.GetDevice(), {
+		{ "NUM_COEFFS", std::to_string(numTetSHCoeffs) },
+		{ "SH_FORMAT",  std::to_string((uint32_t)m_precision.sh) } }), TetCount(), parameters);
+}
+
+inline void TetrahedronScene::SetTetLayout(CommandContext& context, const TetLayout layout) {
+	m_tetLayout = layout;
+	if (vertices && !m_pending)
+		PackTetRecords(context);
+}
+
 // inline void TetrahedronScene::AddTetrahedra(
 //     CommandContext& context,
 //     const std::vector<uint4>& new_indices,
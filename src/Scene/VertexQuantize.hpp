@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cfloat>
+#include <cmath>
+#include <span>
+#include <vector>
+
+#include <Rose/Core/RoseEngine.h>
+
+#include "Parallel.hpp"
+
+namespace vkDelTet {
+
+using namespace RoseEngine;
+
+// Storage formats for the vertex buffer. Values match kVertexFormat* in TetrahedronScene.slang.
+enum class VertexFormat : uint32_t {
+	eFloat32 = 0, // float3, 12 bytes
+	eUNorm21 = 1, // 21-21-22 bit fixed point relative to the scene AABB, packed in a uint2 (8 bytes)
+};
+
+inline const char* VertexFormatName(const VertexFormat f) {
+	switch (f) {
+		case VertexFormat::eFloat32: return "fp32";
+		case VertexFormat::eUNorm21: return "21-21-22 bit";
+		default: return "unknown";
+	}
+}
+
+static constexpr uint32_t kVertexQuantBitsX = 21;
+static constexpr uint32_t kVertexQuantBitsY = 21;
+static constexpr uint32_t kVertexQuantBitsZ = 22;
+static const     float3   kVertexQuantMax   = float3((1u << kVertexQuantBitsX) - 1, (1u << kVertexQuantBitsY) - 1, (1u << kVertexQuantBitsZ) - 1);
+
+// Layout: x in bits [0,21) of .x, y in bits [21,32) of .x and [0,10) of .y, z in bits [10,32) of .y.
+inline uint2 QuantizeVertex(const float3 p, const float3 aabbMin, const float3 aabbMax) {
+	const float3 extent = aabbMax - aabbMin;
+	float3 t = float3(0);
+	for (int i = 0; i < 3; i++)
+		if (extent[i] > 0)
+			t[i] = std::clamp((p[i] - aabbMin[i]) / extent[i], 0.f, 1.f);
+	const uint32_t x = (uint32_t)std::lround(t.x * kVertexQuantMax.x);
+	const uint32_t y = (uint32_t)std::lround(t.y * kVertexQuantMax.y);
+	const uint32_t z = (uint32_t)std::lround(t.z * kVertexQuantMax.z);
+	return uint2(x | (y << kVertexQuantBitsX), (y >> (32 - kVertexQuantBitsX)) | (z << (kVertexQuantBitsX + kVertexQuantBitsY - 32)));
+}
+
+// Mirrors TetrahedronScene::load_vertex, including its float32 arithmetic.
+inline float3 DequantizeVertex(const uint2 q, const float3 aabbMin, const float3 aabbMax) {
+	const uint32_t x = q.x & ((1u << kVertexQuantBitsX) - 1);
+	const uint32_t y = (q.x >> kVertexQuantBitsX) | ((q.y & ((1u << (kVertexQuantBitsX + kVertexQuantBitsY - 32)) - 1)) << (32 - kVertexQuantBitsX));
+	const uint32_t z = q.y >> (kVertexQuantBitsX + kVertexQuantBitsY - 32);
+	return aabbMin + (float3(float(x), float(y), float(z)) / kVertexQuantMax) * (aabbMax - aabbMin);
+}
+
+// Upper bound on |load_vertex(i) - vertices_cpu[i]| per axis for vertices inside the AABB:
+// half a quantization step, plus a few float32 roundings of the decode.
+inline float3 VertexQuantizationError(const float3 aabbMin, const float3 aabbMax) {
+	const float3 extent = aabbMax - aabbMin;
+	const float3 magnitude = max(abs(aabbMin), abs(aabbMax));
+	return 0.5f * extent / kVertexQuantMax + 4 * FLT_EPSILON * (magnitude + extent);
+}
+
+inline std::vector<uint2> QuantizeVertices(const std::span<const float3> vertices, const float3 aabbMin, const float3 aabbMax) {
+	std::vector<uint2> result(vertices.size());
+	ParallelFor(vertices.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			result[i] = QuantizeVertex(vertices[i], aabbMin, aabbMax);
+	});
+	return result;
+}
+
+}